@@ -0,0 +1,1051 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+extern "C" {
+#include <unistd.h>
+}
+
+#include <pacemaker/pacemaker.hpp>
+
+// Microbenchmarks for the sequencer and the real-time path.
+// Results are printed to stdout as JSON so they can be compared between
+// releases. An optional argument only runs benchmarks containing it, or
+// `--check` skips the benchmarks and only runs the checks.
+namespace {
+	using namespace std::literals;
+
+	// Minimum time each benchmark is run for.
+	constexpr auto BENCH_MIN_TIME = 200ms;
+
+	// Keeps the optimiser from discarding results.
+	volatile int64_t sink;
+
+	struct Result {
+		std::string name;
+		size_t iterations;
+		size_t items;
+		double seconds;
+	};
+
+	struct Bench {
+		std::string_view filter;
+		std::vector<Result> results;
+
+		// `fn(iterations)` runs the benchmarked code `iterations` times and
+		// returns how many items (events, calls...) it processed.
+		template <typename F>
+		void run(const std::string& name, F&& fn) {
+			if (name.find(filter) == std::string::npos) {
+				return;
+			}
+
+			size_t iterations = 1;
+
+			while (true) {
+				auto start = std::chrono::steady_clock::now();
+				size_t items = fn(iterations);
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+				if (elapsed >= BENCH_MIN_TIME) {
+					results.push_back({ name, iterations, items, elapsed.count() });
+					pacemaker::info(name, ": ", elapsed.count() * 1e9 / static_cast<double>(iterations), "ns/iter");
+					return;
+				}
+
+				iterations *= 2;
+			}
+		}
+
+		void report(std::ostream& os) const {
+			os << "{\n  \"benchmarks\": [";
+
+			for (size_t i = 0; i != results.size(); ++i) {
+				auto& [name, iterations, items, seconds] = results[i];
+
+				os << (i == 0 ? "\n" : ",\n");
+				os << "    {\"name\": \"" << name << "\", ";
+				os << "\"iterations\": " << iterations << ", ";
+				os << "\"ns_per_iteration\": " << seconds * 1e9 / static_cast<double>(iterations) << ", ";
+				os << "\"items_per_second\": " << static_cast<double>(items) / seconds << "}";
+			}
+
+			os << "\n  ]\n}\n";
+		}
+	};
+
+	pacemaker::Patch make_patch(size_t channels,
+		size_t notes,
+		std::mt19937_64& rng,
+		pacemaker::Unit min_period = 10ms,
+		pacemaker::Unit max_period = 2s) {
+		std::uniform_int_distribution<int64_t> frequency(min_period.count(), max_period.count());
+		std::uniform_int_distribution<int64_t> offset(0, 1'000'000);
+		std::uniform_int_distribution<int> note(0, 127);
+
+		pacemaker::Patch p;
+
+		for (size_t i = 0; i != channels; ++i) {
+			pacemaker::Notes ns;
+
+			for (size_t j = 0; j != notes; ++j) {
+				ns.push_back(static_cast<pacemaker::MidiNote>(note(rng)));
+			}
+
+			p.emplace_back(pacemaker::Status { static_cast<pacemaker::MidiChannel>(i % 16), pacemaker::MIDI_NOTE_ON },
+				pacemaker::Unit { frequency(rng) },
+				pacemaker::Unit { offset(rng) },
+				ns);
+		}
+
+		return p;
+	}
+
+	void bench_timing(Bench& b, std::mt19937_64& rng) {
+		std::uniform_int_distribution<int64_t> dist(1, 1'000'000'000);
+		std::vector<pacemaker::Unit> xs(1024);
+
+		for (auto& x: xs) {
+			x = pacemaker::Unit { dist(rng) };
+		}
+
+		b.run("event_at", [&](size_t iterations) {
+			int64_t acc = 0;
+
+			for (size_t i = 0; i != iterations; ++i) {
+				auto& x = xs[i % xs.size()];
+				acc += pacemaker::detail::event_at(x, xs[(i + 1) % xs.size()], xs[(i + 2) % xs.size()]).count();
+			}
+
+			sink = acc;
+			return iterations;
+		});
+
+		b.run("events_between", [&](size_t iterations) {
+			int64_t acc = 0;
+
+			for (size_t i = 0; i != iterations; ++i) {
+				auto& x = xs[i % xs.size()];
+				acc += pacemaker::detail::events_between(x, x + 1s, xs[(i + 1) % xs.size()], xs[(i + 2) % xs.size()]);
+			}
+
+			sink = acc;
+			return iterations;
+		});
+	}
+
+	void bench_timeline(Bench& b, std::mt19937_64& rng) {
+		for (size_t channels: { 1, 10, 100, 1'000, 10'000 }) {
+			for (size_t notes: { 1, 16, 128 }) {
+				auto p = pacemaker::CompiledPatch { make_patch(channels, notes, rng) };
+				auto suffix = "/" + std::to_string(channels) + "ch/" + std::to_string(notes) + "n";
+
+				b.run("timeline" + suffix, [&](size_t iterations) {
+					size_t items = 0;
+
+					for (size_t i = 0; i != iterations; ++i) {
+						pacemaker::Unit begin = 1s * static_cast<int64_t>(i);
+						items += pacemaker::timeline(begin, begin + 1s, p).size();
+					}
+
+					return items;
+				});
+
+				b.run("timeline_arena" + suffix, [&](size_t iterations) {
+					pacemaker::WindowArena arena;
+					size_t items = 0;
+
+					for (size_t i = 0; i != iterations; ++i) {
+						pacemaker::Unit begin = 1s * static_cast<int64_t>(i);
+						items += pacemaker::timeline(begin, begin + 1s, p, arena.resource()).size();
+						arena.reset();
+					}
+
+					return items;
+				});
+
+				// The merge on its own, without collecting into a timeline.
+				b.run("merge" + suffix, [&](size_t iterations) {
+					pacemaker::TimelineGenerator gen { 0s, 0s, p };
+					size_t items = 0;
+					int64_t acc = 0;
+
+					for (size_t i = 0; i != iterations; ++i) {
+						pacemaker::Unit begin = 1s * static_cast<int64_t>(i);
+						gen.reset(begin, begin + 1s);
+
+						for (const auto& ev: gen) {
+							acc += ev.midi[1];
+							++items;
+						}
+					}
+
+					sink = acc;
+					return items;
+				});
+			}
+		}
+	}
+
+	// Consecutive live-sized windows of many sparse channels, where the
+	// batch renderer's per-channel work dominates and the wheel only looks
+	// at the few channels that fire.
+	void bench_sparse(Bench& b, std::mt19937_64& rng) {
+		for (size_t channels: { 1'000, 100'000 }) {
+			auto p = pacemaker::CompiledPatch { make_patch(channels, 1, rng, 10s, 1h) };
+			auto suffix = "/" + std::to_string(channels) + "ch";
+
+			b.run("sparse_batch" + suffix, [&](size_t iterations) {
+				pacemaker::BatchRenderer renderer;
+				size_t items = 0;
+
+				for (size_t i = 0; i != iterations; ++i) {
+					pacemaker::Unit begin = 100ms * static_cast<int64_t>(i);
+					items += renderer.render(begin, begin + 100ms, p).size();
+				}
+
+				return items;
+			});
+
+			b.run("sparse_wheel" + suffix, [&](size_t iterations) {
+				pacemaker::WheelRenderer renderer;
+				size_t items = 0;
+
+				for (size_t i = 0; i != iterations; ++i) {
+					pacemaker::Unit begin = 100ms * static_cast<int64_t>(i);
+					items += renderer.render(begin, begin + 100ms, p).size();
+				}
+
+				return items;
+			});
+		}
+	}
+
+	// A four on the floor click with an eighth note hi-hat at 120 BPM.
+	constexpr auto make_click = [] {
+		return pacemaker::Patch {
+			pacemaker::Channel { { 9, pacemaker::MIDI_NOTE_ON }, 500ms, 0ms, pacemaker::Notes { 36 } },
+			pacemaker::Channel { { 9, pacemaker::MIDI_NOTE_OFF }, 500ms, 100ms, pacemaker::Notes { 36 } },
+			pacemaker::Channel { { 9, pacemaker::MIDI_NOTE_ON }, 250ms, 0ms, pacemaker::Notes { 42 } },
+			pacemaker::Channel { { 9, pacemaker::MIDI_NOTE_OFF }, 250ms, 50ms, pacemaker::Notes { 42 } },
+		};
+	};
+
+	constexpr auto click = pacemaker::loop_table(make_click);
+
+	// Playing a static patch from its loop table against rendering it.
+	void bench_loop(Bench& b) {
+		auto p = pacemaker::CompiledPatch { make_click() };
+
+		b.run("loop_wheel", [&](size_t iterations) {
+			pacemaker::WheelRenderer renderer;
+			size_t items = 0;
+
+			for (size_t i = 0; i != iterations; ++i) {
+				pacemaker::Unit begin = 100ms * static_cast<int64_t>(i);
+				items += renderer.render(begin, begin + 100ms, p).size();
+			}
+
+			return items;
+		});
+
+		b.run("loop_table", [&](size_t iterations) {
+			auto view = click.view();
+			size_t items = 0;
+
+			for (size_t i = 0; i != iterations; ++i) {
+				pacemaker::Unit begin = 100ms * static_cast<int64_t>(i);
+				view.between(begin, begin + 100ms, [&](const pacemaker::Event&) { ++items; });
+			}
+
+			return items;
+		});
+	}
+
+	// Windows rendered before allocations are counted and while they are.
+	// Buffers grow to fit the busiest window, so the warm-up has to include
+	// one about as busy as any that follow.
+	constexpr size_t WARMUP_WINDOWS = 64;
+	constexpr size_t STEADY_WINDOWS = 256;
+
+	// Renders consecutive windows of the same length with `fn(begin, end)`
+	// and returns how many allocations the steady state made from
+	// `counter`.
+	template <typename F>
+	uint64_t steady_state_allocations(pacemaker::CountingResource& counter, F&& fn) {
+		pacemaker::Unit begin {};
+
+		for (size_t i = 0; i != WARMUP_WINDOWS; ++i, begin += 100ms) {
+			fn(begin, begin + 100ms);
+		}
+
+		counter.reset();
+
+		for (size_t i = 0; i != STEADY_WINDOWS; ++i, begin += 100ms) {
+			fn(begin, begin + 100ms);
+		}
+
+		return counter.allocations.load(std::memory_order_relaxed);
+	}
+
+	// The writer thread's rendering must not allocate once warmed up.
+	// Everything the renderers allocate goes through the default memory
+	// resource, which counts while this runs. Returns `false` if anything
+	// allocated.
+	bool check_allocations(std::mt19937_64& rng) {
+		auto p = pacemaker::CompiledPatch { make_patch(1'000, 16, rng) };
+		bool ok = true;
+
+		pacemaker::CountingResource counter;
+		auto* previous = std::pmr::set_default_resource(&counter);
+
+		auto check = [&](std::string_view name, uint64_t n) {
+			if (n != 0) {
+				pacemaker::error(name, ": ", n, " allocations after warm-up");
+				ok = false;
+			}
+		};
+
+		{
+			pacemaker::BatchRenderer batch;
+			check("batch", steady_state_allocations(counter, [&](auto begin, auto end) {
+				sink = static_cast<int64_t>(batch.render(begin, end, p).size());
+			}));
+
+			pacemaker::WheelRenderer wheel;
+			check("wheel", steady_state_allocations(counter, [&](auto begin, auto end) {
+				sink = static_cast<int64_t>(wheel.render(begin, end, p).size());
+			}));
+
+			pacemaker::WindowArena arena { pacemaker::ARENA_SIZE, &counter };
+			check("arena", steady_state_allocations(counter, [&](auto begin, auto end) {
+				sink = static_cast<int64_t>(pacemaker::timeline(begin, end, p, arena.resource()).size());
+				arena.reset();
+			}));
+		}
+
+		std::pmr::set_default_resource(previous);
+
+		return ok;
+	}
+
+	constexpr size_t RENDERER_CHECK_WINDOWS = 20'000;
+
+	// Render random window sequences with `WheelRenderer` and
+	// `BatchRenderer` and compare both with `TimelineGenerator`. Windows mostly
+	// follow on from the last one but sometimes skip ahead, jump back or
+	// come with a freshly compiled patch in the same place as the old one,
+	// which the wheel has to notice. Returns `false` on any mismatch.
+	bool check_renderers(std::mt19937_64& rng) {
+		std::uniform_int_distribution<size_t> channels(1, 64);
+		std::uniform_int_distribution<size_t> notes(1, 4);
+		std::uniform_int_distribution<int64_t> length(0, 200'000);
+		std::uniform_int_distribution<int64_t> jump(-2'000'000, 2'000'000);
+		std::uniform_int_distribution<int> kind(0, 9);
+
+		pacemaker::WheelRenderer wheel;
+		pacemaker::BatchRenderer batch;
+
+		std::vector<pacemaker::Event> expected;
+
+		std::optional<pacemaker::CompiledPatch> patch;
+		pacemaker::Unit begin {};
+
+		for (size_t i = 0; i != RENDERER_CHECK_WINDOWS; ++i) {
+			switch (kind(rng)) {
+				case 0: {
+					patch.reset();
+					break;
+				}
+
+				case 1: {
+					begin += pacemaker::Unit { jump(rng) };
+					break;
+				}
+
+				default: {
+					break;
+				}
+			}
+
+			if (not patch) {
+				patch.emplace(make_patch(channels(rng), notes(rng), rng, 1ms, 300ms));
+			}
+
+			pacemaker::Unit end = begin + pacemaker::Unit { length(rng) };
+
+			expected.clear();
+
+			for (auto& ev: pacemaker::TimelineGenerator { begin, end, *patch }) {
+				expected.push_back(ev);
+			}
+			auto& from_wheel = wheel.render(begin, end, *patch);
+			auto& from_batch = batch.render(begin, end, *patch);
+
+			for (auto [name, got]: { std::pair { "wheel", &from_wheel }, std::pair { "batch", &from_batch } }) {
+				if (not std::equal(got->begin(), got->end(), expected.begin(), expected.end())) {
+					pacemaker::error(name,
+						": [",
+						begin.count(),
+						", ",
+						end.count(),
+						") has ",
+						got->size(),
+						" events instead of ",
+						expected.size());
+
+					return false;
+				}
+			}
+
+			begin = end;
+		}
+
+		return true;
+	}
+
+	constexpr size_t TEMPO_CHECK_WINDOWS = 20'000;
+
+	// Render windows the way the writer does while the tempo changes between
+	// them. Every channel plays all 128 notes in order, so each channel's
+	// next event must be the next note and later than the last one: no
+	// event repeated or skipped across a change. Returns `false` on any
+	// mismatch.
+	bool check_tempo(std::mt19937_64& rng) {
+		std::uniform_int_distribution<int64_t> period(1, 50);
+		std::uniform_int_distribution<int64_t> offset(0, 1'000'000);
+		std::uniform_int_distribution<int64_t> length(1, 100'000);
+		std::uniform_int_distribution<uint32_t> tempo(250, 4'000);
+		std::uniform_int_distribution<int> kind(0, 9);
+
+		pacemaker::Notes notes(128);
+		std::iota(notes.begin(), notes.end(), 0);
+
+		pacemaker::Patch p;
+
+		for (uint8_t ch = 0; ch != 16; ++ch) {
+			p.emplace_back(pacemaker::Status { ch, pacemaker::MIDI_NOTE_ON },
+				pacemaker::Unit { period(rng) * 1'000 },
+				pacemaker::Unit { offset(rng) },
+				notes);
+		}
+
+		pacemaker::TempoMap tempo_map { p };
+		pacemaker::CompiledPatch patch { p };
+		pacemaker::WheelRenderer renderer;
+
+		std::array<std::optional<pacemaker::Event>, 16> last;
+		pacemaker::Unit begin {};
+
+		for (size_t i = 0; i != TEMPO_CHECK_WINDOWS; ++i) {
+			if (kind(rng) == 0) {
+				begin = tempo_map.apply({ p, tempo(rng) }, begin);
+				patch = pacemaker::CompiledPatch { tempo_map.playing };
+			}
+
+			pacemaker::Unit end = begin + pacemaker::Unit { length(rng) };
+
+			for (auto& ev: renderer.render(begin, end, patch)) {
+				auto& previous = last[ev.midi[0] & 0x0F];
+
+				if (previous and (ev.timestamp <= previous->timestamp or ev.midi[1] != (previous->midi[1] + 1) % 128)) {
+					pacemaker::error("tempo: note ",
+						static_cast<int>(ev.midi[1]),
+						" at ",
+						ev.timestamp.count(),
+						" follows note ",
+						static_cast<int>(previous->midi[1]),
+						" at ",
+						previous->timestamp.count());
+
+					return false;
+				}
+
+				previous = ev;
+			}
+
+			begin = end;
+		}
+
+		return true;
+	}
+
+	// Random runs checked against the scalar kernel.
+	constexpr size_t KERNEL_RUNS = 10'000;
+
+	// Every kernel the CPU can run must write exactly the events the scalar
+	// reference does. Returns `false` on any mismatch.
+	bool check_kernels(std::mt19937_64& rng) {
+		std::vector<std::pair<std::string_view, pacemaker::detail::FillRun>> kernels;
+
+#ifdef PACEMAKER_SIMD_X86
+		if (__builtin_cpu_supports("avx2")) {
+			kernels.emplace_back("avx2", pacemaker::detail::fill_run_avx2);
+		}
+#endif
+
+		std::uniform_int_distribution<int64_t> time(-1'000'000'000, 1'000'000'000);
+		std::uniform_int_distribution<int64_t> period(1, 10'000'000);
+		std::uniform_int_distribution<size_t> count(1, 67);
+		std::uniform_int_distribution<uint32_t> note_count(1, 5);
+		std::uniform_int_distribution<int> byte(0, 127);
+
+		std::vector<pacemaker::MidiNote> notes;
+		std::vector<pacemaker::Event> expected;
+		std::vector<pacemaker::Event> got;
+
+		bool ok = true;
+
+		for (size_t i = 0; i != KERNEL_RUNS; ++i) {
+			notes.resize(note_count(rng));
+
+			for (auto& note: notes) {
+				note = static_cast<pacemaker::MidiNote>(byte(rng));
+			}
+
+			pacemaker::detail::Run run {
+				pacemaker::Unit { time(rng) },
+				pacemaker::Unit { period(rng) },
+				static_cast<pacemaker::MidiStatus>(0x80 | byte(rng)),
+				static_cast<pacemaker::PortIndex>(byte(rng) % pacemaker::MAX_PORTS),
+				notes.data(),
+				static_cast<uint32_t>(notes.size()),
+				static_cast<uint32_t>(rng() % notes.size()),
+				count(rng),
+			};
+
+			expected.assign(run.count, {});
+			pacemaker::detail::fill_run_scalar(expected.data(), run);
+
+			for (auto& [name, kernel]: kernels) {
+				got.assign(run.count, {});
+				kernel(got.data(), run);
+
+				if (got != expected) {
+					pacemaker::error(name, ": differs from the scalar kernel for a run of ", run.count, " events");
+					ok = false;
+				}
+			}
+		}
+
+		return ok;
+	}
+
+	// Loop spread over two ports plus one more port the check's client
+	// doesn't have.
+	constexpr auto make_loop = [] {
+		return pacemaker::Patch {
+			pacemaker::Channel { { 9, pacemaker::MIDI_NOTE_ON }, 250ms, 0ms, pacemaker::Notes { 36 }, 0 },
+			pacemaker::Channel { { 9, pacemaker::MIDI_NOTE_OFF }, 250ms, 100ms, pacemaker::Notes { 36 }, 0 },
+			pacemaker::Channel { { 0, pacemaker::MIDI_NOTE_ON }, 300ms, 7ms, pacemaker::Notes { 60, 64, 67 }, 1 },
+			pacemaker::Channel { { 1, pacemaker::MIDI_NOTE_ON }, 150ms, 20ms, pacemaker::Notes { 40 }, 2 },
+		};
+	};
+
+	constexpr auto loop = pacemaker::loop_table(make_loop);
+
+	// 2ms cycles so cycle boundaries and the loop's events fall on exact
+	// frames and microseconds.
+	constexpr jack_nframes_t LOOP_CHECK_RATE = 48'000;
+	constexpr jack_nframes_t LOOP_CHECK_FRAMES = 96;
+	constexpr size_t LOOP_CHECK_CYCLES = 2'000;
+
+	// Play the loop through the process callback and compare every port's
+	// output against the frames its events are due on. Events for the
+	// missing port must be counted as dropped. Returns `false` on any
+	// mismatch.
+	bool check_loop() {
+		auto fake = std::make_unique<pacemaker::FakeBackend>(LOOP_CHECK_RATE, LOOP_CHECK_FRAMES);
+		auto& backend = *fake;
+
+		pacemaker::JackClient client { std::move(fake) };
+		client.port_register_output("loop_0");
+		client.port_register_output("loop_1");
+
+		client.enable_loop().play(loop.view());
+		client.ready();
+
+		auto begin = backend.now();
+		backend.step(LOOP_CHECK_CYCLES);
+		auto end = backend.now();
+
+		bool ok = true;
+		uint64_t missing = 0;
+
+		std::vector<std::vector<pacemaker::FakeCapture>> expected(client.ports.size());
+
+		loop.view().between(begin, end, [&](const pacemaker::Event& ev) {
+			if (ev.port < expected.size()) {
+				expected[ev.port].push_back({ pacemaker::to_frames(ev.timestamp, LOOP_CHECK_RATE), ev.midi });
+			}
+			else {
+				++missing;
+			}
+		});
+
+		auto port = backend.ports.begin();
+
+		for (size_t i = 0; i != expected.size(); ++i, ++port) {
+			auto& got = port->captured;
+			auto& due = expected[i];
+
+			bool same = std::equal(got.begin(), got.end(), due.begin(), due.end(), [](auto& a, auto& b) {
+				return a.frame == b.frame and a.midi == b.midi;
+			});
+
+			if (not same) {
+				pacemaker::error("loop: port ", i, " played ", got.size(), " events but not the ", due.size(), " due");
+				ok = false;
+			}
+		}
+
+		auto stats = client.stats.snapshot();
+
+		if (stats.loop_dropped != missing) {
+			pacemaker::error("loop: ", stats.loop_dropped, " events dropped, expected ", missing);
+			ok = false;
+		}
+
+		return ok;
+	}
+
+	// Fresh empty file for a check, removed again when this goes out of
+	// scope.
+	struct TempFile {
+		std::string path;
+
+		explicit TempFile(std::string_view name): path("/tmp/pacemaker_" + std::string { name } + "_XXXXXX") {
+			int fd = ::mkstemp(path.data());
+
+			if (fd < 0) {
+				pacemaker::fatal_error("could not create a temporary file");
+			}
+
+			::close(fd);
+		}
+
+		~TempFile() {
+			::unlink(path.c_str());
+		}
+
+		TempFile(const TempFile&) = delete;
+		TempFile& operator=(const TempFile&) = delete;
+	};
+
+	constexpr size_t CAPTURE_CHECK_CYCLES = 500;
+
+	// Feed random input through the process callback into a capture file,
+	// shut down the way pacemaker does and compare the file with what was
+	// sent. Returns `false` on any mismatch.
+	bool check_capture(std::mt19937_64& rng) {
+		TempFile file { "capture" };
+		std::vector<pacemaker::CaptureRecord> sent;
+
+		{
+			auto fake = std::make_unique<pacemaker::FakeBackend>(48'000, 128);
+			auto& backend = *fake;
+
+			pacemaker::JackClient client { std::move(fake) };
+			client.port_register_input("capture_in_0");
+			client.port_register_input("capture_in_1");
+
+			pacemaker::CaptureFile capture { client.enable_capture(), file.path };
+			client.ready();
+
+			std::uniform_int_distribution<jack_nframes_t> offset(0, backend.buffer_size() - 1);
+			std::uniform_int_distribution<int> count(0, 4);
+			std::uniform_int_distribution<int> byte(0, 127);
+
+			for (size_t i = 0; i != CAPTURE_CHECK_CYCLES; ++i) {
+				for (size_t port = 0; port != client.inputs.size(); ++port) {
+					std::vector<jack_nframes_t> offsets(static_cast<size_t>(count(rng)));
+
+					for (auto& o: offsets) {
+						o = offset(rng);
+					}
+
+					std::sort(offsets.begin(), offsets.end());
+
+					for (auto o: offsets) {
+						pacemaker::Midi midi {
+							pacemaker::MIDI_NOTE_ON,
+							static_cast<pacemaker::MidiPrimitive>(byte(rng)),
+							static_cast<pacemaker::MidiPrimitive>(byte(rng)),
+						};
+
+						backend.send_input(client.inputs[port].get(), o, midi);
+
+						auto frame = static_cast<jack_nframes_t>(backend.frames.load()) + o;
+						sent.push_back({ {}, frame, midi, static_cast<pacemaker::PortIndex>(port) });
+					}
+				}
+
+				backend.step();
+			}
+
+			// Stop the callback before the capture file is closed, as
+			// pacemaker does.
+			client.stop();
+		}
+
+		// Records are written in the order they were read, port by port
+		// within a cycle.
+		std::ifstream is { file.path, std::ios::binary };
+
+		pacemaker::CaptureHeader header;
+		is.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+		if (not is or header != pacemaker::CAPTURE_HEADER) {
+			pacemaker::error("capture: bad header");
+			return false;
+		}
+
+		std::vector<pacemaker::CaptureRecord> got;
+
+		for (pacemaker::CaptureRecord record; is.read(reinterpret_cast<char*>(&record), sizeof(record));) {
+			got.push_back(record);
+		}
+
+		bool same = std::equal(got.begin(), got.end(), sent.begin(), sent.end(), [](auto& a, auto& b) {
+			return a.frame == b.frame and a.midi == b.midi and a.port == b.port;
+		});
+
+		if (not same) {
+			pacemaker::error("capture: recorded ", got.size(), " events but not the ", sent.size(), " sent");
+			return false;
+		}
+
+		return true;
+	}
+
+	constexpr size_t MAPPED_CHECK_FILES = 24;
+	constexpr size_t MAPPED_CHECK_WINDOWS = 500;
+
+	// Write timeline files with random patches and index strides, map them
+	// and compare `between` with `timeline` for random windows. Half of the
+	// channels tick together so runs of equal timestamps straddle index
+	// entries, and windows often start or end right on an indexed event or
+	// past the last one. Returns `false` on any mismatch.
+	bool check_mapped(std::mt19937_64& rng) {
+		constexpr pacemaker::Unit length = 2s;
+
+		constexpr std::array<uint32_t, 6> strides { 1, 2, 3, 7, 64, pacemaker::TIMELINE_INDEX_STRIDE };
+
+		std::uniform_int_distribution<size_t> stride(0, strides.size() - 1);
+		std::uniform_int_distribution<int64_t> time(-100'000, length.count() + 100'000);
+		std::uniform_int_distribution<int> kind(0, 3);
+
+		bool ok = true;
+
+		for (size_t i = 0; i != MAPPED_CHECK_FILES; ++i) {
+			auto p = make_patch(8, 3, rng, 1ms, 50ms);
+
+			for (size_t ch = 1; ch != p.size() / 2; ++ch) {
+				p[ch].frequency = p[0].frequency;
+				p[ch].offset = p[0].offset;
+			}
+
+			uint32_t index_stride = strides[stride(rng)];
+
+			TempFile file { "mapped" };
+
+			{
+				std::ofstream os { file.path, std::ios::binary };
+				pacemaker::write_timeline(os, pacemaker::Unit { 0 }, length, p, index_stride);
+			}
+
+			pacemaker::MappedTimeline mapped { file.path };
+			pacemaker::CompiledPatch cp { p };
+
+			// Mostly random, sometimes the timestamp of an indexed event.
+			auto bound = [&] {
+				if (kind(rng) != 0 or mapped.index_count == 0) {
+					return pacemaker::Unit { time(rng) };
+				}
+
+				return pacemaker::Unit { mapped.index[rng() % mapped.index_count] };
+			};
+
+			for (size_t j = 0; j != MAPPED_CHECK_WINDOWS; ++j) {
+				auto first = bound();
+				auto last = bound();
+
+				if (last < first) {
+					std::swap(first, last);
+				}
+
+				auto got = mapped.between(first, last);
+				auto expected = pacemaker::timeline(
+					std::max(first, pacemaker::Unit { 0 }), std::clamp(last, pacemaker::Unit { 0 }, length), cp);
+
+				if (not std::equal(got.begin(), got.end(), expected.begin(), expected.end())) {
+					pacemaker::error("mapped: [",
+						first.count(),
+						", ",
+						last.count(),
+						") with a stride of ",
+						index_stride,
+						" has ",
+						got.size(),
+						" events instead of ",
+						expected.size());
+
+					ok = false;
+					break;
+				}
+			}
+		}
+
+		return ok;
+	}
+
+	constexpr jack_nframes_t THRU_CHECK_RATE = 48'000;
+	constexpr size_t THRU_CHECK_CYCLES = 500;
+
+	// A cycle of exactly a millisecond and events on every sixth frame, a
+	// whole number of microseconds apart, so all of them convert to frames
+	// without rounding and land on the same offsets often.
+	constexpr jack_nframes_t THRU_CHECK_FRAMES = 48;
+	constexpr jack_nframes_t THRU_CHECK_STRIDE = 6;
+
+	// Play input events through a transposing rule and a pattern while the
+	// sequencer writes to the same ports, and compare what left each port
+	// with the expected merge: by frame, thru before the sequencer at the
+	// same frame and thru events in the order they were produced. Returns
+	// `false` on any mismatch.
+	bool check_thru(std::mt19937_64& rng) {
+		using namespace std::chrono_literals;
+
+		constexpr pacemaker::MidiStatus CONTROL_CHANGE = 0xB0;
+
+		auto fake = std::make_unique<pacemaker::FakeBackend>(THRU_CHECK_RATE, THRU_CHECK_FRAMES);
+		auto& backend = *fake;
+
+		pacemaker::JackClient client { std::move(fake) };
+		client.port_register_output("thru_0");
+		client.port_register_output("thru_1");
+		client.port_register_input("thru_in_0");
+		client.port_register_input("thru_in_1");
+
+		pacemaker::ThruRule transpose;
+		transpose.inputs = 0b01;
+		transpose.transpose = 12;
+		transpose.port = 0;
+
+		pacemaker::ThruRule pattern;
+		pattern.inputs = 0b10;
+		pattern.pattern = { { 0ms, 1ms, 0 }, { 5ms, 1ms, 7 } };
+		pattern.port = 1;
+
+		client.enable_thru().publish({ transpose, pattern });
+		client.ready();
+
+		// Ordered by frame, thru first, then the order events were made in.
+		struct Expected {
+			pacemaker::Frame frame;
+			bool is_sequenced;
+			size_t order;
+			pacemaker::Midi midi;
+
+			auto operator<=>(const Expected&) const = default;
+		};
+
+		std::vector<std::vector<Expected>> expected(client.ports.size());
+		size_t order = 0;
+
+		std::uniform_int_distribution<jack_nframes_t> slot(0, THRU_CHECK_FRAMES / THRU_CHECK_STRIDE - 1);
+		std::uniform_int_distribution<int> count(0, 3);
+		std::uniform_int_distribution<int> channel(0, 15);
+		std::uniform_int_distribution<int> note(0, 100);
+		std::uniform_int_distribution<int> velocity(1, 127);
+		std::uniform_int_distribution<int> kind(0, 2);
+
+		constexpr std::array<int, 3> statuses { pacemaker::MIDI_NOTE_ON, pacemaker::MIDI_NOTE_OFF, CONTROL_CHANGE };
+
+		auto random_slots = [&] {
+			std::vector<jack_nframes_t> slots(static_cast<size_t>(count(rng)));
+
+			for (auto& s: slots) {
+				s = slot(rng);
+			}
+
+			std::sort(slots.begin(), slots.end());
+			return slots;
+		};
+
+		auto byte = [](int x) {
+			return static_cast<pacemaker::MidiPrimitive>(x);
+		};
+
+		for (size_t i = 0; i != THRU_CHECK_CYCLES; ++i) {
+			auto frame = backend.frames.load();
+
+			// The transposing rule forwards everything but moves notes up an
+			// octave.
+			for (auto s: random_slots()) {
+				auto offset = s * THRU_CHECK_STRIDE;
+				int status = statuses[static_cast<size_t>(kind(rng))];
+				pacemaker::Midi midi { byte(status | channel(rng)), byte(note(rng)), byte(velocity(rng)) };
+
+				backend.send_input(client.inputs[0].get(), offset, midi);
+
+				if (status != CONTROL_CHANGE) {
+					midi[1] = byte(midi[1] + 12);
+				}
+
+				expected[0].push_back({ frame + offset, false, order++, midi });
+			}
+
+			// The pattern plays two notes per note on and drops note offs.
+			for (auto s: random_slots()) {
+				auto offset = s * THRU_CHECK_STRIDE;
+				bool is_on = kind(rng) != 0;
+				int ch = channel(rng);
+				int key = note(rng);
+				int vel = velocity(rng);
+
+				auto status = is_on ? pacemaker::MIDI_NOTE_ON : pacemaker::MIDI_NOTE_OFF;
+				backend.send_input(client.inputs[1].get(), offset, { byte(status | ch), byte(key), byte(vel) });
+
+				if (not is_on) {
+					continue;
+				}
+
+				for (auto [delay, interval]: { std::pair { 0, 0 }, std::pair { 240, 7 } }) {
+					auto at = frame + offset + static_cast<pacemaker::Frame>(delay);
+
+					pacemaker::Midi on { byte(pacemaker::MIDI_NOTE_ON | ch), byte(key + interval), byte(vel) };
+					pacemaker::Midi off { byte(pacemaker::MIDI_NOTE_OFF | ch), byte(key + interval), 0 };
+
+					expected[1].push_back({ at, false, order++, on });
+					expected[1].push_back({ at + THRU_CHECK_FRAMES, false, order++, off });
+				}
+			}
+
+			// Sequencer events on both ports at the same kind of offsets.
+			for (size_t port = 0; port != client.ports.size(); ++port) {
+				for (auto s: random_slots()) {
+					auto offset = s * THRU_CHECK_STRIDE;
+					auto timestamp = pacemaker::to_unit(frame + offset, THRU_CHECK_RATE);
+					pacemaker::Midi midi { CONTROL_CHANGE, byte(port), byte(velocity(rng)) };
+
+					client.ports[port].send({ timestamp, midi, static_cast<pacemaker::PortIndex>(port) });
+					expected[port].push_back({ frame + offset, true, order++, midi });
+				}
+			}
+
+			backend.step();
+		}
+
+		bool ok = true;
+		auto end = backend.frames.load();
+		auto port = backend.ports.begin();
+
+		for (size_t i = 0; i != expected.size(); ++i, ++port) {
+			auto& due = expected[i];
+
+			std::sort(due.begin(), due.end());
+			std::erase_if(due, [&](auto& ev) {
+				return ev.frame >= end;
+			});
+
+			auto& got = port->captured;
+
+			bool same = std::equal(got.begin(), got.end(), due.begin(), due.end(), [](auto& a, auto& b) {
+				return a.frame == b.frame and a.midi == b.midi;
+			});
+
+			if (not same) {
+				pacemaker::error("thru: port ", i, " wrote ", got.size(), " events but not the ", due.size(), " due");
+				ok = false;
+			}
+		}
+
+		return ok;
+	}
+
+	// The real process callback driven by the fake backend, so it includes
+	// the virtual backend calls and MIDI buffer writes. Events are spread
+	// evenly over the ports.
+	void bench_process(Bench& b) {
+		for (size_t n_ports: { 1, 16 }) {
+			for (size_t per_cycle: { 1, 16, 256 }) {
+				auto fake = std::make_unique<pacemaker::FakeBackend>(48'000, 1'024);
+				auto& backend = *fake;
+
+				pacemaker::JackClient client { std::move(fake) };
+
+				for (size_t i = 0; i != n_ports; ++i) {
+					client.port_register_output("bench_" + std::to_string(i));
+				}
+
+				backend.capture = false;
+				client.ready();
+
+				std::vector<pacemaker::Event> events(per_cycle);
+				auto period = pacemaker::to_unit(backend.buffer_size(), backend.sample_rate());
+
+				auto name = "process_callback/" + std::to_string(n_ports) + "p/" + std::to_string(per_cycle) + "ev";
+
+				b.run(name, [&](size_t iterations) {
+					for (size_t i = 0; i != iterations; ++i) {
+						auto begin = backend.now();
+
+						for (size_t j = 0; j != per_cycle; ++j) {
+							auto t = begin + period * static_cast<int64_t>(j) / static_cast<int64_t>(per_cycle);
+							events[j] = { t, { 0x90, 64, 127 }, static_cast<pacemaker::PortIndex>(j % n_ports) };
+						}
+
+						for (auto& ev: events) {
+							client.ports[ev.port].send(ev);
+						}
+
+						backend.step();
+					}
+
+					sink = static_cast<int64_t>(backend.frames.load());
+					return iterations * per_cycle;
+				});
+			}
+		}
+	}
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+	Bench b { argc > 1 ? argv[1] : "", {} };
+	std::mt19937_64 rng { 0 };
+
+	if (b.filter != "--check") {
+		bench_timing(b, rng);
+		bench_timeline(b, rng);
+		bench_sparse(b, rng);
+		bench_loop(b);
+		bench_process(b);
+
+		b.report(std::cout);
+	}
+
+	bool ok = check_allocations(rng);
+	ok = check_kernels(rng) and ok;
+	ok = check_renderers(rng) and ok;
+	ok = check_tempo(rng) and ok;
+	ok = check_loop() and ok;
+	ok = check_capture(rng) and ok;
+	ok = check_thru(rng) and ok;
+	ok = check_mapped(rng) and ok;
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#ifndef PACEMAKER_ARENA_HPP
+#define PACEMAKER_ARENA_HPP
+
+#include <atomic>
+#include <memory_resource>
+#include <optional>
+
+#include <cstddef>
+#include <cstdint>
+
+// Memory resources for generating events without touching the global
+// allocator, so contention on it from other threads in the process can't
+// delay the writer.
+namespace pacemaker {
+	// Initial size of a `WindowArena`'s buffer.
+	constexpr size_t ARENA_SIZE = 1 << 20;
+
+	// Forwards to `upstream` and counts what passes through. Counters are
+	// relaxed so this can sit under several threads, it's meant for checking
+	// that a steady state doesn't allocate rather than for accounting.
+	struct CountingResource: std::pmr::memory_resource {
+		std::pmr::memory_resource* upstream;
+
+		std::atomic<uint64_t> allocations = 0;
+		std::atomic<uint64_t> bytes = 0;
+
+		explicit CountingResource(std::pmr::memory_resource* upstream_ = std::pmr::new_delete_resource()):
+				upstream(upstream_) {}
+
+		void reset() {
+			allocations.store(0, std::memory_order_relaxed);
+			bytes.store(0, std::memory_order_relaxed);
+		}
+
+		void* do_allocate(size_t size, size_t alignment) override {
+			allocations.fetch_add(1, std::memory_order_relaxed);
+			bytes.fetch_add(size, std::memory_order_relaxed);
+
+			return upstream->allocate(size, alignment);
+		}
+
+		void do_deallocate(void* p, size_t size, size_t alignment) override {
+			upstream->deallocate(p, size, alignment);
+		}
+
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+			return this == &other;
+		}
+	};
+
+	// Monotonic arena for everything allocated while generating one window.
+	// Deallocation is a no-op and `reset` frees it all at once. A window that
+	// overflows the buffer spills into `upstream` and the buffer is grown to
+	// match on the next `reset`, so after a few windows of similar size the
+	// arena stops allocating altogether.
+	struct WindowArena {
+		std::pmr::memory_resource* upstream;
+
+		std::byte* buffer;
+		size_t capacity;
+
+		// Whatever didn't fit in `buffer` this window.
+		pacemaker::CountingResource overflow;
+
+		std::optional<std::pmr::monotonic_buffer_resource> arena;
+
+		explicit WindowArena(size_t capacity_ = ARENA_SIZE,
+			std::pmr::memory_resource* upstream_ = std::pmr::new_delete_resource()):
+				upstream(upstream_),
+				buffer(static_cast<std::byte*>(upstream->allocate(capacity_))),
+				capacity(capacity_),
+				overflow(upstream_) {
+			arena.emplace(buffer, capacity, &overflow);
+		}
+
+		~WindowArena() {
+			arena.reset();
+			upstream->deallocate(buffer, capacity);
+		}
+
+		WindowArena(const WindowArena&) = delete;
+		WindowArena& operator=(const WindowArena&) = delete;
+
+		std::pmr::memory_resource* resource() {
+			return &*arena;
+		}
+
+		// Free everything allocated since the last reset. Anything allocated
+		// from the arena must not be used afterwards.
+		void reset() {
+			arena->release();
+
+			uint64_t spilled = overflow.bytes.load(std::memory_order_relaxed);
+
+			if (spilled == 0) {
+				return;
+			}
+
+			arena.reset();
+			upstream->deallocate(buffer, capacity);
+
+			capacity += static_cast<size_t>(spilled);
+			buffer = static_cast<std::byte*>(upstream->allocate(capacity));
+
+			overflow.reset();
+			arena.emplace(buffer, capacity, &overflow);
+		}
+	};
+}  // namespace pacemaker
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef PACEMAKER_BACKEND_HPP
+#define PACEMAKER_BACKEND_HPP
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include <jack/types.h>
+}
+
+#include <pacemaker/timing.hpp>
+#include <pacemaker/sequencer.hpp>
+
+namespace pacemaker {
+	struct JackClient;
+
+	// Opaque handle to a port owned by a backend.
+	using PortHandle = void*;
+
+	// Timing of the cycle currently being processed. See `jack_get_cycle_times`.
+	struct CycleTimes {
+		jack_nframes_t current_frames;
+		jack_time_t current_usecs;
+		jack_time_t next_usecs;
+		float period_usecs;
+	};
+
+	// Everything `JackClient` needs from the audio server. The functions
+	// marked real-time are called from inside of the process callback and
+	// must not allocate or block.
+	struct Backend {
+		virtual ~Backend() = default;
+
+		// Route every one of the server's callbacks to `client`.
+		virtual void attach(JackClient& client) = 0;
+
+		virtual bool activate() = 0;
+		virtual void deactivate() = 0;
+
+		virtual jack_nframes_t sample_rate() const = 0;
+		virtual jack_nframes_t buffer_size() const = 0;
+
+		// Current time in the same domain as event timestamps.
+		virtual pacemaker::Unit now() const = 0;
+
+		// Real-time.
+		virtual bool cycle_times(CycleTimes& times) const = 0;
+		virtual float xrun_delayed_usecs() const = 0;
+
+		// Percentage of the cycle spent processing by the whole server.
+		virtual float cpu_load() const = 0;
+
+		// `SCHED_FIFO` priority of the process thread or -1 if it doesn't run
+		// in real-time.
+		virtual int real_time_priority() const = 0;
+
+		virtual void* port_buffer(PortHandle port, jack_nframes_t nframes) = 0;
+		virtual void midi_clear(void* buffer) = 0;
+		virtual bool midi_write(void* buffer, jack_nframes_t offset, const pacemaker::Midi& midi) = 0;
+
+		// Real-time. Reading an input port's buffer, events are in offset
+		// order. Returns `false` for messages longer than three bytes (e.g.
+		// SysEx) which are skipped.
+		virtual uint32_t midi_event_count(void* buffer) = 0;
+		virtual bool midi_read(void* buffer, uint32_t index, jack_nframes_t& offset, pacemaker::Midi& midi) = 0;
+
+		// Port registry.
+		virtual PortHandle port_register(const std::string& name, unsigned long flags) = 0;
+		virtual void port_unregister(PortHandle port) = 0;
+
+		virtual bool port_is_mine(PortHandle port) const = 0;
+		virtual bool port_connect(PortHandle port, const std::string& dst) = 0;
+		virtual bool port_disconnect(PortHandle port, const std::string& dst) = 0;
+		virtual bool port_rename(PortHandle port, const std::string& name) = 0;
+
+		virtual int port_connected(PortHandle port) const = 0;
+		virtual std::vector<std::string> port_connections(PortHandle port) const = 0;
+
+		virtual std::vector<std::string> get_ports(const std::string& name, unsigned long flags) const = 0;
+
+		// Name of any port on the server by its id, for logging from the
+		// notification callbacks. Empty if there is no such port.
+		virtual const char* port_name(jack_port_id_t id) const = 0;
+	};
+}  // namespace pacemaker
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef PACEMAKER_BATCH_HPP
+#define PACEMAKER_BATCH_HPP
+
+#include <algorithm>
+#include <array>
+#include <memory_resource>
+#include <type_traits>
+#include <vector>
+#include <utility>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <pacemaker/timing.hpp>
+#include <pacemaker/sequencer.hpp>
+#include <pacemaker/trace.hpp>
+
+#if defined(__x86_64__) and (defined(__GNUC__) or defined(__clang__))
+	#define PACEMAKER_SIMD_X86
+	#include <immintrin.h>
+#endif
+
+// Batch event generation for rendering whole windows at once. Every channel
+// is expanded into a run of events with a vectorised kernel and the runs are
+// then merged. Unlike `TimelineGenerator` there is no per-event heap work.
+namespace pacemaker {
+	namespace detail {
+		// The kernels write events as two 64 bit words: the timestamp and the
+		// MIDI bytes (status, note, velocity) followed by the port in the low
+		// bytes of the second.
+		static_assert(sizeof(pacemaker::Event) == 16);
+		static_assert(offsetof(pacemaker::Event, midi) == 8 and offsetof(pacemaker::Event, port) == 11);
+		static_assert(sizeof(pacemaker::Unit) == 8);
+		static_assert(std::is_trivially_copyable_v<pacemaker::Event>);
+
+		// One channel's events within a window.
+		struct Run {
+			pacemaker::Unit first_event;
+			pacemaker::Unit period;
+
+			MidiStatus status;
+			PortIndex port;
+
+			const MidiNote* notes;
+			uint32_t note_count;
+
+			// Position in `notes` of the first event.
+			uint32_t note_index;
+
+			size_t count;
+		};
+
+		constexpr uint64_t midi_word(const Run& run, MidiNote note, MidiVelocity velocity = 127) {
+			return uint64_t { run.status } | uint64_t { note } << 8 | uint64_t { velocity } << 16 |
+				uint64_t { run.port } << 24;
+		}
+
+		inline void store_event(pacemaker::Event* out, int64_t timestamp, uint64_t midi) {
+			std::memcpy(reinterpret_cast<char*>(out), &timestamp, sizeof(timestamp));
+			std::memcpy(reinterpret_cast<char*>(out) + 8, &midi, sizeof(midi));
+		}
+
+		// Reference implementation. Notes are stepped through with a
+		// wrapping index rather than a modulo per event.
+		inline void fill_run_scalar(pacemaker::Event* out, const Run& run) {
+			int64_t timestamp = run.first_event.count();
+			uint32_t k = run.note_index;
+
+			for (size_t i = 0; i != run.count; ++i) {
+				store_event(out + i, timestamp, midi_word(run, run.notes[k]));
+
+				timestamp += run.period.count();
+				k = (k + 1 == run.note_count) ? 0 : k + 1;
+			}
+		}
+
+#ifdef PACEMAKER_SIMD_X86
+		// Four events per step: their timestamps are advanced together in one
+		// register, interleaved with a register of their MIDI words and
+		// written with two 256 bit stores.
+		__attribute__((target("avx2"))) inline void fill_run_avx2(pacemaker::Event* out, const Run& run) {
+			constexpr size_t WIDTH = 4;
+
+			int64_t first = run.first_event.count();
+			int64_t period = run.period.count();
+			uint32_t k = run.note_index;
+			size_t i = 0;
+
+			__m256i ts = _mm256_set_epi64x(first + period * 3, first + period * 2, first + period, first);
+			__m256i step = _mm256_set1_epi64x(period * static_cast<int64_t>(WIDTH));
+
+			__m256i midi = _mm256_set1_epi64x(static_cast<int64_t>(midi_word(run, run.notes[k])));
+
+			for (; i + WIDTH <= run.count; i += WIDTH) {
+				if (run.note_count != 1) {
+					std::array<int64_t, WIDTH> words;
+
+					for (auto& word: words) {
+						word = static_cast<int64_t>(midi_word(run, run.notes[k]));
+						k = (k + 1 == run.note_count) ? 0 : k + 1;
+					}
+
+					midi = _mm256_set_epi64x(words[3], words[2], words[1], words[0]);
+				}
+
+				// Events 0 and 2 and events 1 and 3, then swap the middle
+				// halves to get them back in order.
+				__m256i even = _mm256_unpacklo_epi64(ts, midi);
+				__m256i odd = _mm256_unpackhi_epi64(ts, midi);
+
+				__m256i first_two = _mm256_permute2x128_si256(even, odd, 0x20);
+				__m256i last_two = _mm256_permute2x128_si256(even, odd, 0x31);
+
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), first_two);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 2), last_two);
+
+				ts = _mm256_add_epi64(ts, step);
+			}
+
+			Run tail = run;
+			tail.first_event = run.first_event + run.period * static_cast<int64_t>(i);
+			tail.note_index = k;
+			tail.count = run.count - i;
+
+			fill_run_scalar(out + i, tail);
+		}
+#endif
+
+		using FillRun = void (*)(pacemaker::Event*, const Run&);
+
+		// Use the AVX2 kernel if the CPU has it.
+		inline FillRun select_fill_run() {
+#ifdef PACEMAKER_SIMD_X86
+			__builtin_cpu_init();
+
+			if (__builtin_cpu_supports("avx2")) {
+				return fill_run_avx2;
+			}
+#endif
+
+			return fill_run_scalar;
+		}
+
+		inline const FillRun fill_run = select_fill_run();
+	}  // namespace detail
+
+	// Renders windows of a compiled patch into a sorted buffer. Buffers are
+	// kept between calls so rendering consecutive windows doesn't allocate
+	// once they've grown large enough, and whatever allocation there is goes
+	// to `resource`.
+	struct BatchRenderer {
+		std::pmr::vector<detail::Run> runs;
+		std::pmr::vector<size_t> bounds;
+		std::pmr::vector<size_t> next_bounds;
+
+		pacemaker::pmr::Timeline events;
+		pacemaker::pmr::Timeline scratch;
+
+		explicit BatchRenderer(std::pmr::memory_resource* resource = std::pmr::get_default_resource()):
+				runs(resource), bounds(resource), next_bounds(resource), events(resource), scratch(resource) {}
+
+		// Returns every event in [begin, end) in the same order as
+		// `TimelineGenerator`. The reference is valid until the next call.
+		const pacemaker::pmr::Timeline& render(
+			pacemaker::Unit begin, pacemaker::Unit end, const pacemaker::CompiledPatch& p) {
+			PACEMAKER_SPAN("render");
+
+			runs.clear();
+
+			for (size_t ch = 0; ch != p.size(); ++ch) {
+				auto frequency = p.period[ch];
+				auto offset = p.phase[ch];
+
+				size_t count = detail::events_between(begin, end, frequency, offset);
+
+				if (count == 0) {
+					continue;
+				}
+
+				int64_t n_before = detail::event_index(begin, frequency, offset);
+
+				runs.push_back({
+					detail::event_at(begin, frequency, offset),
+					frequency,
+					p.status[ch],
+					p.port[ch],
+					p.notes.data() + p.note_offset[ch],
+					p.note_count[ch],
+					static_cast<uint32_t>(detail::phase(n_before, p.note_count[ch])),
+					count,
+				});
+			}
+
+			return render_runs();
+		}
+
+		// Expand and merge whatever is in `runs`, for callers that work out
+		// which channels fire themselves.
+		const pacemaker::pmr::Timeline& render_runs() {
+			size_t total = 0;
+
+			for (auto& run: runs) {
+				total += run.count;
+			}
+
+			events.resize(total);
+			scratch.resize(total);
+
+			bounds.clear();
+			bounds.push_back(0);
+
+			for (auto& run: runs) {
+				detail::fill_run(events.data() + bounds.back(), run);
+				bounds.push_back(bounds.back() + run.count);
+			}
+
+			merge_runs();
+
+			return events;
+		}
+
+		// Each run is already sorted so merge neighbouring pairs until only
+		// one is left, ping-ponging between `events` and `scratch`.
+		void merge_runs() {
+			while (bounds.size() > 2) {
+				next_bounds.clear();
+				next_bounds.push_back(0);
+
+				size_t i = 0;
+
+				for (; i + 2 < bounds.size(); i += 2) {
+					std::merge(events.begin() + static_cast<std::ptrdiff_t>(bounds[i]),
+						events.begin() + static_cast<std::ptrdiff_t>(bounds[i + 1]),
+						events.begin() + static_cast<std::ptrdiff_t>(bounds[i + 1]),
+						events.begin() + static_cast<std::ptrdiff_t>(bounds[i + 2]),
+						scratch.begin() + static_cast<std::ptrdiff_t>(bounds[i]));
+
+					next_bounds.push_back(bounds[i + 2]);
+				}
+
+				// Odd run out.
+				if (i + 1 < bounds.size()) {
+					std::copy(events.begin() + static_cast<std::ptrdiff_t>(bounds[i]),
+						events.begin() + static_cast<std::ptrdiff_t>(bounds[i + 1]),
+						scratch.begin() + static_cast<std::ptrdiff_t>(bounds[i]));
+
+					next_bounds.push_back(bounds[i + 1]);
+				}
+
+				std::swap(events, scratch);
+				std::swap(bounds, next_bounds);
+			}
+		}
+	};
+
+	// Everything is allocated from `resource`, including the result. With a
+	// `WindowArena` that is reset between windows this never reaches the
+	// global allocator once the arena has grown to fit a window.
+	inline pacemaker::pmr::Timeline timeline(pacemaker::Unit begin,
+		pacemaker::Unit end,
+		const pacemaker::CompiledPatch& p,
+		std::pmr::memory_resource* resource) {
+		PACEMAKER_SPAN("timeline");
+
+		pacemaker::BatchRenderer renderer { resource };
+		renderer.render(begin, end, p);
+
+		return std::move(renderer.events);
+	}
+
+	inline pacemaker::Timeline timeline(pacemaker::Unit begin, pacemaker::Unit end, const pacemaker::CompiledPatch& p) {
+		PACEMAKER_SPAN("timeline");
+
+		pacemaker::BatchRenderer renderer;
+		const auto& events = renderer.render(begin, end, p);
+
+		return { events.begin(), events.end() };
+	}
+
+	inline pacemaker::Timeline timeline(pacemaker::Unit begin, pacemaker::Unit end, const pacemaker::Patch& p) {
+		return timeline(begin, end, pacemaker::CompiledPatch { p });
+	}
+}  // namespace pacemaker
+
+#endif
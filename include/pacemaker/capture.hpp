@@ -0,0 +1,169 @@
+#ifndef PACEMAKER_CAPTURE_HPP
+#define PACEMAKER_CAPTURE_HPP
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <jack/types.h>
+}
+
+#include <pacemaker/util.hpp>
+#include <pacemaker/queue.hpp>
+#include <pacemaker/timing.hpp>
+#include <pacemaker/sequencer.hpp>
+
+// Recording of incoming MIDI. The process callback stamps every event read
+// from an input port and pushes it onto a lock-free queue, a background
+// thread drains the queue in batches and appends them to a file.
+//
+// A capture file is a `CaptureHeader` followed by fixed-width
+// `CaptureRecord`s in the host's byte order. Files are only ever appended to
+// so a session can be resumed into the same file.
+namespace pacemaker {
+	// Capacity of the queue between the process callback and the writer (in
+	// records). At the default interval this absorbs over a million events
+	// per second.
+	constexpr size_t CAPTURE_QUEUE_SIZE = 1 << 16;
+
+	// Records written per `write` call when there's a backlog.
+	constexpr size_t CAPTURE_BATCH = 4'096;
+
+	constexpr auto CAPTURE_INTERVAL = std::chrono::milliseconds { 50 };
+
+	struct CaptureRecord {
+		// Same clock as event timestamps.
+		pacemaker::Unit timestamp;
+
+		// JACK's frame counter at the event, wraps around.
+		jack_nframes_t frame;
+
+		// Zero padded for messages shorter than three bytes.
+		pacemaker::Midi midi;
+
+		// Index of the input port in `JackClient::inputs`.
+		PortIndex port;
+	};
+
+	static_assert(sizeof(CaptureRecord) == 16);
+	static_assert(std::is_trivially_copyable_v<CaptureRecord>);
+
+	struct CaptureHeader {
+		std::array<char, 8> magic;
+		uint32_t version;
+		uint32_t record_size;
+
+		bool operator==(const CaptureHeader&) const = default;
+	};
+
+	constexpr CaptureHeader CAPTURE_HEADER { { 'P', 'M', 'C', 'A', 'P', 'T', 'U', 'R' }, 1, sizeof(CaptureRecord) };
+
+	using CaptureQueue = pacemaker::SpscQueue<CaptureRecord, CAPTURE_QUEUE_SIZE>;
+
+	// Appends everything pushed onto `queue` to `path`. Records still queued
+	// when this is destroyed are written before the file is closed.
+	struct CaptureFile {
+		int fd;
+
+		// Only used to wake the thread up early when stopping.
+		std::mutex mutex;
+		std::condition_variable_any wake;
+
+		std::jthread thread;
+
+		CaptureFile(CaptureQueue& queue, const std::string& path): fd(open_file(path)) {
+			thread = std::jthread { [this, &queue](std::stop_token stop) {
+				std::vector<CaptureRecord> batch(CAPTURE_BATCH);
+				std::unique_lock lock { mutex };
+
+				while (not stop.stop_requested()) {
+					flush(queue, batch);
+					wake.wait_for(lock, stop, CAPTURE_INTERVAL, [] { return false; });
+				}
+
+				flush(queue, batch);
+			} };
+		}
+
+		~CaptureFile() {
+			thread.request_stop();
+			thread.join();
+
+			::close(fd);
+		}
+
+		CaptureFile(const CaptureFile&) = delete;
+		CaptureFile& operator=(const CaptureFile&) = delete;
+
+		void flush(CaptureQueue& queue, std::vector<CaptureRecord>& batch) {
+			while (size_t n = queue.pop(batch.data(), batch.size())) {
+				if (not write_all(fd, batch.data(), n * sizeof(CaptureRecord))) {
+					pacemaker::warning("could not write capture: ", std::strerror(errno));
+				}
+			}
+		}
+
+		// Open for appending, writing the header if the file is new.
+		static int open_file(const std::string& path) {
+			int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+			if (fd < 0) {
+				pacemaker::fatal_error("could not open `", path, "`: ", std::strerror(errno));
+			}
+
+			CaptureHeader header;
+			auto n = ::pread(fd, &header, sizeof(header), 0);
+
+			if (n == 0) {
+				if (not write_all(fd, &CAPTURE_HEADER, sizeof(CAPTURE_HEADER))) {
+					int error = errno;
+					::close(fd);
+					pacemaker::fatal_error("could not write `", path, "`: ", std::strerror(error));
+				}
+			}
+			else if (static_cast<size_t>(n) != sizeof(header) or header != CAPTURE_HEADER) {
+				::close(fd);
+				pacemaker::fatal_error("`", path, "` is not a capture file");
+			}
+
+			return fd;
+		}
+
+		// Write all of `data`, retrying short writes.
+		static bool write_all(int fd, const void* data, size_t size) {
+			auto* p = static_cast<const char*>(data);
+
+			while (size != 0) {
+				auto n = ::write(fd, p, size);
+
+				if (n < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+
+					return false;
+				}
+
+				p += n;
+				size -= static_cast<size_t>(n);
+			}
+
+			return true;
+		}
+	};
+}  // namespace pacemaker
+
+#endif
@@ -3,13 +3,23 @@
 
 // Misc. Constants
 namespace pacemaker {
-	constexpr auto RINGBUFFER_SIZE = 16'384;
+	// Capacity of each port's event queue (in events).
+	constexpr auto QUEUE_SIZE = 4'096;
+
+	// Capacity of the port table, the process callback walks it every cycle.
+	constexpr auto MAX_PORTS = 64;
 }
 
 // Strings
 namespace pacemaker {
 	constexpr auto STR_CLIENT_NAME = "pacemaker";
 
+	constexpr auto STR_USAGE =
+		"usage: pacemaker [--patch <file>] [--stats <file>] [--trace <file>] [--capture <file>] [--input <port>]... "
+		"[--thru <output> [--transpose <semitones>]] [--play <file> [--seek <seconds>]] [--mlock] [--cpus <list>] "
+		"[--priority <1-99>] [--control <socket>] <port>... | "
+		"pacemaker [--patch <file>] --render <file> [--duration <seconds>] [--raw | --timeline]";
+
 	constexpr auto STR_WARNING_STARTED = "JACK server was started";
 
 	constexpr auto STR_ERROR_CLIENT = "could not open client";
@@ -30,6 +40,7 @@ namespace pacemaker {
 namespace pacemaker {
 	constexpr auto MIDI_NOTE_OFF = 0b1000'0000;
 	constexpr auto MIDI_NOTE_ON = 0b1001'0000;
+	constexpr auto MIDI_POLY_AFTERTOUCH = 0b1010'0000;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,468 @@
+#ifndef PACEMAKER_CONTROL_HPP
+#define PACEMAKER_CONTROL_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+#include <pacemaker/const.hpp>
+#include <pacemaker/util.hpp>
+#include <pacemaker/queue.hpp>
+#include <pacemaker/swap.hpp>
+#include <pacemaker/sequencer.hpp>
+#include <pacemaker/trace.hpp>
+
+// Local control plane. Other programs on the machine send commands as
+// datagrams to a UNIX socket, one command per datagram. Everything is in host
+// byte order:
+//
+//     char magic[2] = "PM"; uint8_t version = 1; uint8_t op;
+//
+// followed by the payload for `op`:
+//
+//     MUTE   uint64_t ports       bit `i` mutes `JackClient::ports[i]`
+//     TEMPO  uint32_t permille    speed relative to the patch, 1000 plays it as written
+//     NOTES  uint16_t channel     the rest of the datagram is the channel's new notes
+//     PATCH                       the rest of the datagram is a patch in the patch language
+//
+// Mutes are applied by the process callback at the start of the next cycle.
+// The others hand the patch as written and its tempo to the writer, which
+// picks up the latest at the start of the next window it generates, so
+// they're heard once the events already queued have played.
+//
+// None of them jump the phase. A change takes effect at the first event the
+// writer hasn't generated yet: that event plays exactly when it would have
+// and every channel carries on from there at the new tempo, keeping its
+// place in its notes and its phase relative to the other channels.
+namespace pacemaker {
+	constexpr std::array<char, 2> CONTROL_MAGIC { 'P', 'M' };
+	constexpr uint8_t CONTROL_VERSION = 1;
+
+	// Capacity of the queue of commands for the process callback.
+	constexpr size_t CONTROL_QUEUE_SIZE = 64;
+
+	// Largest datagram accepted, anything longer is dropped.
+	constexpr size_t CONTROL_MAX_DATAGRAM = 64 * 1'024;
+
+	// How often the control thread checks whether it should stop.
+	constexpr auto CONTROL_POLL = std::chrono::milliseconds { 100 };
+
+	constexpr uint32_t CONTROL_TEMPO_UNITY = 1'000;
+	constexpr uint32_t CONTROL_TEMPO_MIN = 10;
+	constexpr uint32_t CONTROL_TEMPO_MAX = 10'000;
+
+	enum class ControlOp: uint8_t {
+		MUTE = 1,
+		TEMPO = 2,
+		NOTES = 3,
+		PATCH = 4,
+	};
+
+	struct ControlHeader {
+		std::array<char, 2> magic;
+		uint8_t version;
+		pacemaker::ControlOp op;
+	};
+
+	static_assert(sizeof(ControlHeader) == 4);
+
+	// Command for the process callback.
+	struct ControlCommand {
+		pacemaker::ControlOp op;
+		uint64_t ports;
+	};
+
+	using ControlQueue = pacemaker::SpscQueue<pacemaker::ControlCommand, CONTROL_QUEUE_SIZE>;
+
+	// Note offs (and note ons with zero velocity) always get through a mute
+	// so notes that were already sounding are released.
+	inline bool is_muted(uint64_t muted, size_t port, const pacemaker::Midi& midi) {
+		if ((muted >> port & 1) == 0) {
+			return false;
+		}
+
+		auto function = midi[0] & 0xF0;
+		return not (function == MIDI_NOTE_OFF or (function == MIDI_NOTE_ON and midi[2] == 0));
+	}
+
+	// State of the control plane on the process callback's side.
+	struct ControlPath {
+		pacemaker::ControlQueue commands;
+
+		// Bit `i` is set while `JackClient::ports[i]` is muted. Only touched
+		// by the process callback.
+		uint64_t muted = 0;
+
+		// Apply every queued command, called at the start of a cycle.
+		uint64_t apply() {
+			commands.consume([&](const pacemaker::ControlCommand& cmd) {
+				if (cmd.op == ControlOp::MUTE) {
+					muted = cmd.ports;
+				}
+
+				return true;
+			});
+
+			return muted;
+		}
+	};
+
+	// A patch as written and the tempo to play it at, from the control
+	// socket to the writer.
+	struct PatchEdit {
+		pacemaker::Patch patch;
+		uint32_t tempo;
+
+		PatchEdit(pacemaker::Patch patch_, uint32_t tempo_): patch(std::move(patch_)), tempo(tempo_) {}
+	};
+
+	// The writer's side of patch edits. An edit is applied where the writer
+	// is about to start a window, everything before that has been generated
+	// and nothing after it has, so it's lined up with what was really
+	// played rather than with whatever was last sent.
+	struct TempoMap {
+		// What the writer plays and the patch as written it was made from.
+		pacemaker::Patch playing;
+		pacemaker::Patch written;
+		uint32_t tempo = CONTROL_TEMPO_UNITY;
+
+		// `written` is at `position` at time `anchor`.
+		pacemaker::Unit anchor {};
+		pacemaker::Unit position {};
+
+		explicit TempoMap(pacemaker::Patch p): playing(p), written(std::move(p)) {}
+
+		// Play `edit` from `begin` on. Returns where to carry on generating,
+		// the first event `playing` had at or after `begin`. Nothing plays
+		// before it, and starting any earlier would repeat events the new
+		// patch places before it.
+		pacemaker::Unit apply(const pacemaker::PatchEdit& edit, pacemaker::Unit begin) {
+			reanchor(begin);
+
+			playing = scale(edit.patch, edit.tempo);
+			written = edit.patch;
+			tempo = edit.tempo;
+
+			return anchor;
+		}
+
+		// Move the anchor to the first event `playing` has at or after `t`.
+		void reanchor(pacemaker::Unit t) {
+			std::optional<pacemaker::Unit> next;
+
+			for (size_t i = 0; i != playing.size(); ++i) {
+				auto& ch = playing[i];
+
+				if (ch.notes.empty()) {
+					continue;
+				}
+
+				int64_t k = detail::event_index(t, ch.frequency, ch.offset);
+				pacemaker::Unit at = ch.offset + ch.frequency * k;
+
+				// Event `k` of `playing` is event `k` of `written` too.
+				if (not next or at < *next) {
+					next = at;
+					position = written[i].offset + written[i].frequency * k;
+				}
+			}
+
+			// Without any events the patch as written just moves on at the
+			// tempo it was played at.
+			if (not next) {
+				position += pacemaker::Unit { detail::scale((t - anchor).count(), tempo, CONTROL_TEMPO_UNITY) };
+			}
+
+			anchor = next.value_or(t);
+		}
+
+		// `p` at `permille`, lined up with the anchor. Every period is a
+		// multiple of their greatest common divisor, which is scaled once so
+		// channels keep their exact ratios and can't drift apart.
+		pacemaker::Patch scale(const pacemaker::Patch& p, uint32_t permille) const {
+			int64_t unit = 0;
+
+			for (auto& ch: p) {
+				if (not ch.notes.empty()) {
+					unit = std::gcd(unit, ch.frequency.count());
+				}
+			}
+
+			pacemaker::Patch scaled = p;
+
+			if (unit == 0) {
+				return scaled;
+			}
+
+			int64_t scaled_unit = std::max<int64_t>(1, (unit * CONTROL_TEMPO_UNITY + permille / 2) / permille);
+
+			for (auto& ch: scaled) {
+				if (ch.notes.empty()) {
+					continue;
+				}
+
+				// First event at or after the anchor and when it's due at the
+				// new tempo. Its index stays the same so the notes carry on.
+				int64_t k = detail::event_index(position, ch.frequency, ch.offset);
+				pacemaker::Unit first = ch.offset + ch.frequency * k - position;
+				pacemaker::Unit at = anchor + pacemaker::Unit { detail::scale(first.count(), scaled_unit, unit) };
+
+				ch.frequency = pacemaker::Unit { ch.frequency.count() / unit * scaled_unit };
+				ch.offset = at - ch.frequency * k;
+			}
+
+			return scaled;
+		}
+	};
+
+	// Parses patch source, returns nothing after reporting errors.
+	using ParsePatch = std::function<std::optional<pacemaker::Patch>(std::string_view)>;
+
+	// Owns the socket and the thread decoding commands from it. The patch
+	// given to the constructor is the one the writer starts with, tempo
+	// changes are always relative to the last patch received.
+	struct ControlSocket {
+		std::string path;
+		int fd;
+
+		pacemaker::ControlPath& control;
+		pacemaker::HotSwap<const pacemaker::PatchEdit>& edits;
+		pacemaker::ParsePatch parse;
+
+		// Only touched by `thread`.
+		pacemaker::Patch patch;
+		uint32_t tempo = CONTROL_TEMPO_UNITY;
+
+		// Declared last so everything above exists before it starts.
+		std::jthread thread;
+
+		ControlSocket(std::string path_,
+			pacemaker::ControlPath& control_,
+			pacemaker::HotSwap<const pacemaker::PatchEdit>& edits_,
+			pacemaker::Patch patch_,
+			pacemaker::ParsePatch parse_):
+				path(std::move(path_)),
+				fd(bind_socket(path)),
+				control(control_),
+				edits(edits_),
+				parse(std::move(parse_)),
+				patch(std::move(patch_)),
+				thread([this](std::stop_token stop) { run(stop); }) {}
+
+		~ControlSocket() {
+			thread.request_stop();
+			thread.join();
+
+			::close(fd);
+			::unlink(path.c_str());
+		}
+
+		ControlSocket(const ControlSocket&) = delete;
+		ControlSocket& operator=(const ControlSocket&) = delete;
+
+		// Bind a datagram socket at `path`, replacing whatever a previous run
+		// left behind.
+		static int bind_socket(const std::string& path) {
+			sockaddr_un addr {};
+			addr.sun_family = AF_UNIX;
+
+			if (path.size() >= sizeof(addr.sun_path)) {
+				pacemaker::fatal_error("control socket path `", path, "` is too long");
+			}
+
+			std::copy(path.begin(), path.end(), addr.sun_path);
+
+			int fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+			if (fd < 0) {
+				pacemaker::fatal_error("could not create control socket: ", std::strerror(errno));
+			}
+
+			::unlink(path.c_str());
+
+			if (::bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+				int error = errno;
+				::close(fd);
+
+				pacemaker::fatal_error("could not bind `", path, "`: ", std::strerror(error));
+			}
+
+			return fd;
+		}
+
+		void run(std::stop_token stop) {
+			pacemaker::trace_thread_name("control");
+
+			std::vector<std::byte> buffer(CONTROL_MAX_DATAGRAM);
+
+			while (not stop.stop_requested()) {
+				pollfd p { fd, POLLIN, 0 };
+
+				if (::poll(&p, 1, static_cast<int>(CONTROL_POLL.count())) <= 0) {
+					continue;
+				}
+
+				// `MSG_TRUNC` returns the real length so oversized datagrams can
+				// be told apart.
+				ssize_t n = ::recv(fd, buffer.data(), buffer.size(), MSG_TRUNC);
+
+				if (n < 0) {
+					if (errno != EINTR and errno != EAGAIN) {
+						pacemaker::warning("control socket: ", std::strerror(errno));
+					}
+
+					continue;
+				}
+
+				if (static_cast<size_t>(n) > buffer.size()) {
+					pacemaker::warning("control: dropped a ", n, " byte command");
+					continue;
+				}
+
+				handle({ buffer.data(), static_cast<size_t>(n) });
+			}
+		}
+
+		// Decode and apply one datagram.
+		void handle(std::span<const std::byte> datagram) {
+			PACEMAKER_SPAN("control");
+
+			ControlHeader header;
+
+			if (datagram.size() < sizeof(header)) {
+				pacemaker::warning("control: command too short");
+				return;
+			}
+
+			std::memcpy(&header, datagram.data(), sizeof(header));
+
+			if (header.magic != CONTROL_MAGIC or header.version != CONTROL_VERSION) {
+				pacemaker::warning("control: unknown protocol");
+				return;
+			}
+
+			auto payload = datagram.subspan(sizeof(header));
+
+			switch (header.op) {
+				case ControlOp::MUTE: return mute(payload);
+				case ControlOp::TEMPO: return set_tempo(payload);
+				case ControlOp::NOTES: return set_notes(payload);
+				case ControlOp::PATCH: return set_patch(payload);
+			}
+
+			pacemaker::warning("control: unknown command ", static_cast<int>(header.op));
+		}
+
+		// Copy a fixed size payload out, reporting a size mismatch.
+		template <typename T>
+		static bool read(std::span<const std::byte> payload, T& out) {
+			if (payload.size() != sizeof(T)) {
+				pacemaker::warning("control: expected ", sizeof(T), " bytes of arguments, got ", payload.size());
+				return false;
+			}
+
+			std::memcpy(&out, payload.data(), sizeof(T));
+			return true;
+		}
+
+		void mute(std::span<const std::byte> payload) {
+			uint64_t ports = 0;
+
+			if (not read(payload, ports)) {
+				return;
+			}
+
+			if (not control.commands.push({ ControlOp::MUTE, ports })) {
+				pacemaker::warning("control: command queue is full");
+			}
+		}
+
+		void set_tempo(std::span<const std::byte> payload) {
+			uint32_t permille = 0;
+
+			if (not read(payload, permille)) {
+				return;
+			}
+
+			if (permille < CONTROL_TEMPO_MIN or permille > CONTROL_TEMPO_MAX) {
+				pacemaker::warning("control: tempo ", permille, " out of range");
+				return;
+			}
+
+			tempo = permille;
+			publish();
+		}
+
+		void set_notes(std::span<const std::byte> payload) {
+			uint16_t channel = 0;
+
+			if (payload.size() < sizeof(channel)) {
+				pacemaker::warning("control: missing channel");
+				return;
+			}
+
+			std::memcpy(&channel, payload.data(), sizeof(channel));
+
+			if (channel >= patch.size()) {
+				pacemaker::warning("control: no channel ", channel);
+				return;
+			}
+
+			pacemaker::Notes notes;
+
+			for (std::byte b: payload.subspan(sizeof(channel))) {
+				if (std::to_integer<MidiNote>(b) > 127) {
+					pacemaker::warning("control: invalid note ", std::to_integer<int>(b));
+					return;
+				}
+
+				notes.push_back(std::to_integer<MidiNote>(b));
+			}
+
+			patch[channel].notes = std::move(notes);
+			publish();
+		}
+
+		void set_patch(std::span<const std::byte> payload) {
+			std::string_view src { reinterpret_cast<const char*>(payload.data()), payload.size() };
+
+			auto p = parse(src);
+
+			if (not p) {
+				pacemaker::warning("control: could not parse patch");
+				return;
+			}
+
+			patch = std::move(*p);
+			publish();
+		}
+
+		// Hand the patch and tempo to the writer.
+		void publish() {
+			edits.publish(std::make_unique<const pacemaker::PatchEdit>(patch, tempo));
+		}
+	};
+}  // namespace pacemaker
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef PACEMAKER_FAKE_HPP
+#define PACEMAKER_FAKE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pacemaker/const.hpp>
+#include <pacemaker/timing.hpp>
+#include <pacemaker/sequencer.hpp>
+#include <pacemaker/backend.hpp>
+#include <pacemaker/jack.hpp>
+
+// Deterministic stand-in for a JACK server. Time only moves when cycles are
+// run so the full pipeline can be driven from tests, benchmarks and CI
+// without a sound card or real-time scheduling.
+namespace pacemaker {
+	struct FakeMidiEvent {
+		jack_nframes_t offset;
+		pacemaker::Midi midi;
+	};
+
+	// An event as it left a port, stamped with its absolute frame.
+	struct FakeCapture {
+		pacemaker::Frame frame;
+		pacemaker::Midi midi;
+	};
+
+	struct FakePort {
+		std::string name;
+		unsigned long flags;
+
+		std::vector<std::string> connections;
+
+		// Events written during the current cycle. Capacity is reserved up
+		// front so writing never allocates.
+		std::vector<FakeMidiEvent> buffer;
+
+		// Everything written by previous cycles. Only read this while the
+		// backend is stopped.
+		std::vector<FakeCapture> captured;
+
+		// Input ports only, events delivered to the next cycle.
+		std::vector<FakeMidiEvent> pending;
+	};
+
+	struct FakeBackend: Backend {
+		JackClient* target;
+
+		std::list<FakePort> ports;
+
+		std::atomic<jack_nframes_t> rate;
+		std::atomic<jack_nframes_t> nframes;
+
+		// Frame at the start of the next cycle.
+		std::atomic<pacemaker::Frame> frames;
+
+		// Time at frame zero.
+		pacemaker::Unit epoch;
+
+		std::atomic<bool> active;
+		bool capture;
+
+		std::jthread runner;
+
+		FakeBackend(jack_nframes_t rate_ = 48'000, jack_nframes_t nframes_ = 1'024, pacemaker::Unit epoch_ = {}):
+				target(nullptr),
+				rate(rate_),
+				nframes(nframes_),
+				frames(0),
+				epoch(epoch_),
+				active(false),
+				capture(true) {}
+
+		~FakeBackend() {
+			stop();
+		}
+
+		FakeBackend(const FakeBackend&) = delete;
+		FakeBackend& operator=(const FakeBackend&) = delete;
+
+		void attach(JackClient& client) override {
+			target = &client;
+		}
+
+		bool activate() override {
+			active = true;
+			return true;
+		}
+
+		void deactivate() override {
+			stop();
+			active = false;
+		}
+
+		jack_nframes_t sample_rate() const override {
+			return rate.load();
+		}
+
+		jack_nframes_t buffer_size() const override {
+			return nframes.load();
+		}
+
+		pacemaker::Unit now() const override {
+			return epoch + pacemaker::to_unit(frames.load(), rate.load());
+		}
+
+		bool cycle_times(CycleTimes& times) const override {
+			pacemaker::Frame current = frames.load();
+			auto sr = rate.load();
+
+			auto current_usecs = epoch + pacemaker::to_unit(current, sr);
+			auto next_usecs = epoch + pacemaker::to_unit(current + nframes.load(), sr);
+
+			times.current_frames = static_cast<jack_nframes_t>(current);
+			times.current_usecs = static_cast<jack_time_t>(current_usecs.count());
+			times.next_usecs = static_cast<jack_time_t>(next_usecs.count());
+			times.period_usecs = static_cast<float>((next_usecs - current_usecs).count());
+
+			return true;
+		}
+
+		float xrun_delayed_usecs() const override {
+			return 0.0f;
+		}
+
+		float cpu_load() const override {
+			return 0.0f;
+		}
+
+		int real_time_priority() const override {
+			return -1;
+		}
+
+		void* port_buffer(PortHandle port, jack_nframes_t) override {
+			return &to_port(port)->buffer;
+		}
+
+		void midi_clear(void* buffer) override {
+			to_buffer(buffer).clear();
+		}
+
+		// Enforces the same rules as `jack_midi_event_write`: offsets must be
+		// inside of the cycle, must not go backwards and the buffer is finite.
+		bool midi_write(void* buffer, jack_nframes_t offset, const pacemaker::Midi& midi) override {
+			auto& events = to_buffer(buffer);
+
+			if (offset >= nframes.load()) {
+				return false;
+			}
+
+			if (not events.empty() and offset < events.back().offset) {
+				return false;
+			}
+
+			if (events.size() == events.capacity()) {
+				return false;
+			}
+
+			events.push_back({ offset, midi });
+			return true;
+		}
+
+		uint32_t midi_event_count(void* buffer) override {
+			return static_cast<uint32_t>(to_buffer(buffer).size());
+		}
+
+		bool midi_read(void* buffer, uint32_t index, jack_nframes_t& offset, pacemaker::Midi& midi) override {
+			auto& events = to_buffer(buffer);
+
+			if (index >= events.size()) {
+				return false;
+			}
+
+			offset = events[index].offset;
+			midi = events[index].midi;
+
+			return true;
+		}
+
+		PortHandle port_register(const std::string& name, unsigned long flags) override {
+			auto& port = ports.emplace_back();
+
+			port.name = std::string { STR_CLIENT_NAME } + ":" + name;
+			port.flags = flags;
+			port.buffer.reserve(nframes.load());
+
+			return &port;
+		}
+
+		void port_unregister(PortHandle port) override {
+			ports.remove_if([&](const FakePort& p) { return &p == port; });
+		}
+
+		bool port_is_mine(PortHandle port) const override {
+			return std::any_of(ports.begin(), ports.end(), [&](const FakePort& p) { return &p == port; });
+		}
+
+		bool port_connect(PortHandle port, const std::string& dst) override {
+			auto& connections = to_port(port)->connections;
+
+			if (std::find(connections.begin(), connections.end(), dst) != connections.end()) {
+				return false;
+			}
+
+			connections.push_back(dst);
+			return true;
+		}
+
+		bool port_disconnect(PortHandle port, const std::string& dst) override {
+			auto& connections = to_port(port)->connections;
+			auto it = std::find(connections.begin(), connections.end(), dst);
+
+			if (it == connections.end()) {
+				return false;
+			}
+
+			connections.erase(it);
+			return true;
+		}
+
+		bool port_rename(PortHandle port, const std::string& name) override {
+			to_port(port)->name = name;
+			return true;
+		}
+
+		int port_connected(PortHandle port) const override {
+			return static_cast<int>(to_port(port)->connections.size());
+		}
+
+		std::vector<std::string> port_connections(PortHandle port) const override {
+			return to_port(port)->connections;
+		}
+
+		std::vector<std::string> get_ports(const std::string& name, unsigned long flags) const override {
+			std::vector<std::string> names;
+
+			for (auto& port: ports) {
+				if (port.name.find(name) != std::string::npos and (port.flags & flags) == flags) {
+					names.push_back(port.name);
+				}
+			}
+
+			return names;
+		}
+
+		// Ids are positions in `ports`, in the order they were registered.
+		const char* port_name(jack_port_id_t id) const override {
+			auto it = ports.begin();
+
+			for (jack_port_id_t i = 0; i != id and it != ports.end(); ++i) {
+				++it;
+			}
+
+			return it == ports.end() ? "" : it->name.c_str();
+		}
+
+		// Run `n` cycles on the calling thread. Does nothing until activated.
+		void step(size_t n = 1) {
+			for (size_t i = 0; i != n and active; ++i) {
+				pacemaker::Frame current = frames.load();
+
+				for (auto& port: ports) {
+					if (port.flags & JackPortIsInput) {
+						port.buffer.assign(port.pending.begin(), port.pending.end());
+						port.pending.clear();
+					}
+				}
+
+				detail::process_callback(nframes.load(), static_cast<void*>(target));
+
+				if (capture) {
+					for (auto& port: ports) {
+						if (port.flags & JackPortIsInput) {
+							continue;
+						}
+
+						for (auto& [offset, midi]: port.buffer) {
+							port.captured.push_back({ current + offset, midi });
+						}
+					}
+				}
+
+				frames.store(current + nframes.load());
+			}
+		}
+
+		// Run cycles on a background thread at `speed` times real-time, or as
+		// fast as possible if `speed` is zero.
+		void start(double speed = 1.0) {
+			stop();
+
+			runner = std::jthread { [this, speed](std::stop_token token) {
+				auto deadline = std::chrono::steady_clock::now();
+
+				while (not token.stop_requested() and active) {
+					step();
+
+					if (speed > 0.0) {
+						auto period = pacemaker::to_unit(nframes.load(), rate.load());
+						deadline += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period / speed);
+						std::this_thread::sleep_until(deadline);
+					}
+				}
+			} };
+		}
+
+		void stop() {
+			if (runner.joinable()) {
+				runner.request_stop();
+				runner.join();
+			}
+		}
+
+		// Deliver `midi` to an input port during the next cycle. Events must
+		// be sent in offset order. Only call while stopped.
+		void send_input(PortHandle port, jack_nframes_t offset, const pacemaker::Midi& midi) {
+			to_port(port)->pending.push_back({ offset, midi });
+		}
+
+		// Simulate the server changing settings. Only call while stopped.
+		void set_sample_rate(jack_nframes_t new_rate) {
+			rate = new_rate;
+			detail::sample_rate_callback(new_rate, static_cast<void*>(target));
+		}
+
+		void set_buffer_size(jack_nframes_t new_nframes) {
+			nframes = new_nframes;
+
+			for (auto& port: ports) {
+				port.buffer.reserve(new_nframes);
+			}
+
+			detail::buffer_size_callback(new_nframes, static_cast<void*>(target));
+		}
+
+		static FakePort* to_port(PortHandle port) {
+			return static_cast<FakePort*>(port);
+		}
+
+		static std::vector<FakeMidiEvent>& to_buffer(void* buffer) {
+			return *static_cast<std::vector<FakeMidiEvent>*>(buffer);
+		}
+	};
+}  // namespace pacemaker
+
+#endif
@@ -2,8 +2,8 @@
 #define PACEMAKER_JACK_HPP
 
 #include <array>
+#include <atomic>
 #include <vector>
-#include <list>
 #include <functional>
 #include <memory>
 #include <string>
@@ -14,16 +14,28 @@ extern "C" {
 #include <jack/jack.h>
 #include <jack/metadata.h>
 #include <jack/midiport.h>
-#include <jack/ringbuffer.h>
 #include <jack/statistics.h>
 #include <jack/types.h>
 }
 
 #include <pacemaker/const.hpp>
 #include <pacemaker/util.hpp>
+#include <pacemaker/timing.hpp>
+#include <pacemaker/sequencer.hpp>
+#include <pacemaker/queue.hpp>
+#include <pacemaker/backend.hpp>
+#include <pacemaker/stats.hpp>
+#include <pacemaker/capture.hpp>
+#include <pacemaker/thru.hpp>
+#include <pacemaker/refill.hpp>
+#include <pacemaker/loop.hpp>
+#include <pacemaker/control.hpp>
+#include <pacemaker/rt.hpp>
+#include <pacemaker/trace.hpp>
 
 namespace pacemaker {
 	struct JackClient;
+	struct JackBackend;
 
 	namespace detail {
 		inline int process_callback(jack_nframes_t, void*);
@@ -39,7 +51,10 @@ namespace pacemaker {
 
 		inline int xrun_callback(void*);
 
-		// Cast void* argument to JackClient.
+		// Set once the calling thread has been named and its stack mapped.
+		inline thread_local bool is_process_thread = false;
+
+		// Cast void* argument to JackClient. Every callback gets the client.
 		inline JackClient& to_conn(void* arg) {
 			return *static_cast<JackClient*>(arg);
 		}
@@ -51,12 +66,6 @@ namespace pacemaker {
 				jack_free(connections);
 			}
 		};
-
-		struct JackRingBufferDeleter {
-			void operator()(jack_ringbuffer_t* rb) {
-				jack_ringbuffer_free(rb);
-			}
-		};
 	}  // namespace detail
 
 	using JackPortConnections = std::unique_ptr<const char*[], detail::JackPortConnectionsDeleter>;
@@ -90,34 +99,35 @@ namespace pacemaker {
 	struct JackClient;
 	struct JackPort;
 
+	using EventQueue = pacemaker::SpscQueue<pacemaker::Event, QUEUE_SIZE>;
+
 	struct JackPort {
 		JackClient* client;
-		jack_port_t* port;
+		PortHandle port;
 
-		jack_ringbuffer_t* buffer;
+		// Written by the sequencer, drained by the process callback.
+		std::unique_ptr<EventQueue> queue;
 
-		operator jack_port_t*() const {
+		PortHandle get() const {
 			return port;
 		}
 
-		jack_port_t* get() const {
-			return port;
-		}
+		JackPort(): client(nullptr), port(nullptr) {}
 
-		JackPort(JackClient* client_, jack_port_t* port_):
-				client(client_), port(port_), buffer(jack_ringbuffer_create(RINGBUFFER_SIZE)) {}
+		JackPort(JackClient* client_, PortHandle port_):
+				client(client_), port(port_), queue(std::make_unique<EventQueue>()) {}
 
 		~JackPort();
 
 		JackPort(JackPort&& other) noexcept:
 				client(std::exchange(other.client, nullptr)),
 				port(std::exchange(other.port, nullptr)),
-				buffer(std::exchange(other.buffer, nullptr)) {}
+				queue(std::move(other.queue)) {}
 
 		JackPort& operator=(JackPort&& other) noexcept {
 			std::swap(client, other.client);
 			std::swap(port, other.port);
-			std::swap(buffer, other.buffer);
+			std::swap(queue, other.queue);
 
 			return *this;
 		}
@@ -131,7 +141,72 @@ namespace pacemaker {
 
 		void* get_buffer(jack_nframes_t frames) const;
 
-		bool send(const char* data, size_t count);
+		bool send(const pacemaker::Event& ev);
+		size_t send(const pacemaker::Event* first, size_t count);
+	};
+
+	// Ports live in a fixed array so the process callback can walk them in
+	// one linear pass. Registering publishes the new port with a release
+	// store of `count`, so the table can grow while the callback is running.
+	// Ports are only removed when the table is destroyed.
+	struct PortTable {
+		std::array<JackPort, MAX_PORTS> slots;
+		std::atomic<size_t> count;
+
+		PortTable(): count(0) {}
+
+		PortTable(const PortTable&) = delete;
+		PortTable& operator=(const PortTable&) = delete;
+
+		PortTable(PortTable&& other) noexcept: slots(std::move(other.slots)), count(other.count.exchange(0)) {}
+
+		PortTable& operator=(PortTable&& other) noexcept {
+			std::swap(slots, other.slots);
+			count.store(other.count.exchange(count.load()));
+
+			return *this;
+		}
+
+		JackPort& add(JackClient* client, PortHandle port) {
+			size_t n = count.load(std::memory_order_relaxed);
+
+			if (n == slots.size()) {
+				pacemaker::fatal_error("too many ports (max ", MAX_PORTS, ")");
+			}
+
+			slots[n] = JackPort { client, port };
+			count.store(n + 1, std::memory_order_release);
+
+			return slots[n];
+		}
+
+		size_t size() const {
+			return count.load(std::memory_order_acquire);
+		}
+
+		JackPort& operator[](size_t i) {
+			return slots[i];
+		}
+
+		const JackPort& operator[](size_t i) const {
+			return slots[i];
+		}
+
+		JackPort* begin() {
+			return slots.data();
+		}
+
+		JackPort* end() {
+			return slots.data() + size();
+		}
+
+		const JackPort* begin() const {
+			return slots.data();
+		}
+
+		const JackPort* end() const {
+			return slots.data() + size();
+		}
 	};
 
 	namespace detail {
@@ -166,14 +241,10 @@ namespace pacemaker {
 		}
 	}  // namespace detail
 
-	struct JackClient {
-		std::list<JackPort> ports;
-
+	// Backend talking to a real JACK server through libjack.
+	struct JackBackend: Backend {
 		jack_client_t* client;
 
-		jack_nframes_t sample_rate;
-		jack_nframes_t buffer_size;
-
 		operator jack_client_t*() const {
 			return client;
 		}
@@ -182,7 +253,7 @@ namespace pacemaker {
 			return client;
 		}
 
-		JackClient(): client(nullptr), sample_rate(0), buffer_size(0) {
+		JackBackend(): client(nullptr) {
 			jack_status_t flags;
 
 			client = PACEMAKER_DBG(jack_client_open(
@@ -209,18 +280,27 @@ namespace pacemaker {
 				std::pair { JackClientZombie, STR_ERROR_ZOMBIE });
 
 			detail::check_warning(flags, std::pair { JackServerStarted, STR_WARNING_STARTED });
+		}
+
+		~JackBackend() {
+			PACEMAKER_DBG(jack_client_close(client));
+		}
+
+		JackBackend(const JackBackend&) = delete;
+		JackBackend& operator=(const JackBackend&) = delete;
+
+		void attach(JackClient& target) override {
+			void* arg = static_cast<void*>(&target);
 
 			// Notify on changes to sample rate.
 			// We need this information to be correct so we can properly keep
 			// track of time.
-			if (PACEMAKER_DBG(
-					jack_set_sample_rate_callback(client, detail::sample_rate_callback, static_cast<void*>(this)))) {
+			if (PACEMAKER_DBG(jack_set_sample_rate_callback(client, detail::sample_rate_callback, arg))) {
 				pacemaker::fatal_error("could not set sample rate callback");
 			}
 
 			// Notify on changes to buffer size.
-			if (PACEMAKER_DBG(
-					jack_set_buffer_size_callback(client, detail::buffer_size_callback, static_cast<void*>(this)))) {
+			if (PACEMAKER_DBG(jack_set_buffer_size_callback(client, detail::buffer_size_callback, arg))) {
 				pacemaker::fatal_error("could not set buffer size callback");
 			}
 
@@ -228,236 +308,848 @@ namespace pacemaker {
 			// useful for logging purposes.
 
 			// Notify when a new client is registered.
-			if (PACEMAKER_DBG(jack_set_client_registration_callback(
-					client, detail::client_registration_callback, static_cast<void*>(this)))) {
+			auto* on_client_registration = detail::client_registration_callback;
+
+			if (PACEMAKER_DBG(jack_set_client_registration_callback(client, on_client_registration, arg))) {
 				pacemaker::fatal_error("could not set client registration callback");
 			}
 
 			// Notify when a port is connected.
-			if (PACEMAKER_DBG(
-					jack_set_port_connect_callback(client, detail::port_connect_callback, static_cast<void*>(this)))) {
+			if (PACEMAKER_DBG(jack_set_port_connect_callback(client, detail::port_connect_callback, arg))) {
 				pacemaker::fatal_error("could not set port connect callback");
 			}
 
 			// Notify when a new port is registered.
-			if (PACEMAKER_DBG(jack_set_port_registration_callback(
-					client, detail::port_registration_callback, static_cast<void*>(this)))) {
+			if (PACEMAKER_DBG(jack_set_port_registration_callback(client, detail::port_registration_callback, arg))) {
 				pacemaker::fatal_error("could not set port registration callback");
 			}
 
 			// Notify when a port is renamed.
-			if (PACEMAKER_DBG(
-					jack_set_port_rename_callback(client, detail::port_rename_callback, static_cast<void*>(this)))) {
+			if (PACEMAKER_DBG(jack_set_port_rename_callback(client, detail::port_rename_callback, arg))) {
 				pacemaker::fatal_error("could not set port rename callback");
 			}
 
 			// Notify when an xrun occurs.
-			if (PACEMAKER_DBG(jack_set_xrun_callback(client, detail::xrun_callback, static_cast<void*>(this)))) {
+			if (PACEMAKER_DBG(jack_set_xrun_callback(client, detail::xrun_callback, arg))) {
 				pacemaker::fatal_error("could not set xrun callback");
 			}
 
 			// Callback for reading/writing data from/to ports.
-			if (PACEMAKER_DBG(jack_set_process_callback(client, detail::process_callback, static_cast<void*>(this)))) {
+			if (PACEMAKER_DBG(jack_set_process_callback(client, detail::process_callback, arg))) {
 				pacemaker::fatal_error("could not set process callback");
 			}
+		}
+
+		bool activate() override {
+			bool is_fail = PACEMAKER_DBG(jack_activate(client));
+			return not(is_fail);
+		}
+
+		void deactivate() override {
+			PACEMAKER_DBG(jack_deactivate(client));
+		}
+
+		jack_nframes_t sample_rate() const override {
+			return PACEMAKER_DBG(jack_get_sample_rate(client));
+		}
+
+		jack_nframes_t buffer_size() const override {
+			return PACEMAKER_DBG(jack_get_buffer_size(client));
+		}
+
+		pacemaker::Unit now() const override {
+			return pacemaker::Unit { jack_get_time() };
+		}
+
+		bool cycle_times(CycleTimes& times) const override {
+			return not jack_get_cycle_times(
+				client, &times.current_frames, &times.current_usecs, &times.next_usecs, &times.period_usecs);
+		}
+
+		float xrun_delayed_usecs() const override {
+			return jack_get_xrun_delayed_usecs(client);
+		}
+
+		float cpu_load() const override {
+			return jack_cpu_load(client);
+		}
+
+		int real_time_priority() const override {
+			return jack_client_real_time_priority(client);
+		}
+
+		void* port_buffer(PortHandle port, jack_nframes_t nframes) override {
+			return jack_port_get_buffer(to_port(port), nframes);
+		}
+
+		void midi_clear(void* buffer) override {
+			jack_midi_clear_buffer(buffer);
+		}
+
+		bool midi_write(void* buffer, jack_nframes_t offset, const pacemaker::Midi& midi) override {
+			return not jack_midi_event_write(buffer, offset, midi.data(), pacemaker::midi_size(midi[0]));
+		}
+
+		uint32_t midi_event_count(void* buffer) override {
+			return jack_midi_get_event_count(buffer);
+		}
+
+		bool midi_read(void* buffer, uint32_t index, jack_nframes_t& offset, pacemaker::Midi& midi) override {
+			jack_midi_event_t ev;
+
+			if (jack_midi_event_get(&ev, buffer, index) or ev.size == 0 or ev.size > midi.size()) {
+				return false;
+			}
+
+			midi = {};
+			std::copy_n(ev.buffer, ev.size, midi.begin());
+			offset = ev.time;
 
-			buffer_size = PACEMAKER_DBG(jack_get_buffer_size(client));
-			sample_rate = PACEMAKER_DBG(jack_get_sample_rate(client));
+			return true;
 		}
 
-		JackClient(std::list<JackPort>&& ports_,
-			jack_client_t* client_,
-			jack_nframes_t sample_rate_,
-			jack_nframes_t buffer_size_):
-				ports(std::move(ports_)), client(client_), sample_rate(sample_rate_), buffer_size(buffer_size_) {}
+		PortHandle port_register(const std::string& name, unsigned long flags) override {
+			return jack_port_register(client, name.c_str(), JACK_DEFAULT_MIDI_TYPE, flags, 0);
+		}
+
+		void port_unregister(PortHandle port) override {
+			PACEMAKER_DBG(jack_port_unregister(client, to_port(port)));
+		}
+
+		bool port_is_mine(PortHandle port) const override {
+			return jack_port_is_mine(client, to_port(port));
+		}
+
+		// JACK wants connections as (output, input) so our input ports go on
+		// the right hand side.
+		bool port_connect(PortHandle port, const std::string& dst) override {
+			const char* name = jack_port_name(to_port(port));
+			bool is_input = jack_port_flags(to_port(port)) & JackPortIsInput;
+
+			bool is_fail = PACEMAKER_DBG(
+				is_input ? jack_connect(client, dst.c_str(), name) : jack_connect(client, name, dst.c_str()));
+			return not(is_fail);
+		}
+
+		bool port_disconnect(PortHandle port, const std::string& dst) override {
+			const char* name = jack_port_name(to_port(port));
+			bool is_input = jack_port_flags(to_port(port)) & JackPortIsInput;
+
+			bool is_fail = PACEMAKER_DBG(
+				is_input ? jack_disconnect(client, dst.c_str(), name) : jack_disconnect(client, name, dst.c_str()));
+			return not(is_fail);
+		}
+
+		bool port_rename(PortHandle port, const std::string& name) override {
+			bool is_fail = jack_port_rename(client, to_port(port), name.c_str());
+			return not(is_fail);
+		}
+
+		int port_connected(PortHandle port) const override {
+			return jack_port_connected(to_port(port));
+		}
+
+		std::vector<std::string> port_connections(PortHandle port) const override {
+			return detail::null_array_to_vec<const char*, std::string>(jack_port_get_connections, to_port(port));
+		}
+
+		std::vector<std::string> get_ports(const std::string& name, unsigned long flags) const override {
+			return detail::null_array_to_vec<const char*, std::string>(
+				jack_get_ports, client, name.c_str(), JACK_DEFAULT_MIDI_TYPE, flags);
+		}
+
+		const char* port_name(jack_port_id_t id) const override {
+			jack_port_t* port = jack_port_by_id(client, id);
+			return port ? jack_port_name(port) : "";
+		}
+
+		static jack_port_t* to_port(PortHandle port) {
+			return static_cast<jack_port_t*>(port);
+		}
+	};
+
+	struct JackClient {
+		// Prints anything logged from inside of our callbacks. Declared first
+		// so it is destroyed last and flushes everything logged on shutdown.
+		pacemaker::LogDrain log_drain;
+
+		// Declared before the port tables so it outlives them.
+		std::unique_ptr<Backend> backend;
+
+		// Output ports, indexed by `Channel::port`.
+		pacemaker::PortTable ports;
+		pacemaker::PortTable inputs;
+
+		jack_nframes_t sample_rate;
+		jack_nframes_t buffer_size;
+
+		// Written by the callbacks, read by anyone.
+		pacemaker::CycleStats stats;
+
+		// Events read from `inputs` are pushed here when set. Only set
+		// before `ready()`.
+		std::unique_ptr<pacemaker::CaptureQueue> capture;
+
+		// Input events are transformed and forwarded to `ports` when set.
+		// Only set before `ready()`.
+		std::unique_ptr<pacemaker::ThruPath> thru;
+
+		// Posted at the end of a cycle when the queued lookahead runs low.
+		// Only set before `ready()`.
+		std::unique_ptr<pacemaker::Refill> refill;
+
+		// Loop table played straight from the process callback when set.
+		// Only set before `ready()`.
+		std::unique_ptr<pacemaker::LoopPath> loop;
+
+		// Commands from the control plane applied at the start of each cycle
+		// when set. Only set before `ready()`.
+		std::unique_ptr<pacemaker::ControlPath> control;
+
+		JackClient(): JackClient(std::make_unique<JackBackend>()) {}
+
+		explicit JackClient(std::unique_ptr<Backend> backend_):
+				backend(std::move(backend_)), sample_rate(0), buffer_size(0) {
+			backend->attach(*this);
+
+			buffer_size = backend->buffer_size();
+			sample_rate = backend->sample_rate();
+		}
 
 		~JackClient() {
-			PACEMAKER_DBG(jack_deactivate(client));
-			PACEMAKER_DBG(jack_client_close(client));
+			if (backend) {
+				backend->deactivate();
+			}
 		}
 
 		JackClient(JackClient&& other) noexcept:
-				ports(std::exchange(other.ports, {})),
-				client(std::exchange(other.client, nullptr)),
+				log_drain(std::move(other.log_drain)),
+				backend(std::move(other.backend)),
+				ports(std::move(other.ports)),
+				inputs(std::move(other.inputs)),
 				sample_rate(std::exchange(other.sample_rate, 0)),
-				buffer_size(std::exchange(other.buffer_size, 0)) {}
+				buffer_size(std::exchange(other.buffer_size, 0)),
+				capture(std::move(other.capture)),
+				thru(std::move(other.thru)),
+				refill(std::move(other.refill)),
+				loop(std::move(other.loop)),
+				control(std::move(other.control)) {
+			adopt_ports();
+		}
 
 		JackClient& operator=(const JackClient& other) = delete;
 
 		JackClient& operator=(JackClient&& other) noexcept {
+			std::swap(log_drain, other.log_drain);
+			std::swap(backend, other.backend);
 			std::swap(ports, other.ports);
-
-			std::swap(client, other.client);
+			std::swap(inputs, other.inputs);
 
 			std::swap(sample_rate, other.sample_rate);
 			std::swap(buffer_size, other.buffer_size);
 
+			std::swap(capture, other.capture);
+			std::swap(thru, other.thru);
+			std::swap(refill, other.refill);
+			std::swap(loop, other.loop);
+			std::swap(control, other.control);
+
+			adopt_ports();
+			other.adopt_ports();
+
 			return *this;
 		}
 
+		// Point every port back at this client after a move.
+		void adopt_ports() {
+			for (auto& port: ports) {
+				port.client = this;
+			}
+
+			for (auto& port: inputs) {
+				port.client = this;
+			}
+		}
+
 		JackPort& port_register_output(const std::string& name) {
-			return ports.emplace_back(
-				this, jack_port_register(client, name.c_str(), JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0));
+			return ports.add(this, backend->port_register(name, JackPortIsOutput));
 		}
 
 		JackPort& port_register_input(const std::string& name) {
-			return ports.emplace_back(
-				this, jack_port_register(client, name.c_str(), JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0));
+			return inputs.add(this, backend->port_register(name, JackPortIsInput));
+		}
+
+		// Start recording events from every input port. Drain the returned
+		// queue with a `CaptureFile`.
+		pacemaker::CaptureQueue& enable_capture() {
+			if (not capture) {
+				capture = std::make_unique<pacemaker::CaptureQueue>();
+			}
+
+			return *capture;
+		}
+
+		// Start forwarding input events to the output ports. Rules are set
+		// with `ThruPath::publish` and can be replaced at any time.
+		pacemaker::ThruPath& enable_thru() {
+			if (not thru) {
+				thru = std::make_unique<pacemaker::ThruPath>();
+			}
+
+			return *thru;
+		}
+
+		// Have the process callback wake whoever generates events instead of
+		// them polling the queues.
+		pacemaker::Refill& enable_refill() {
+			if (not refill) {
+				refill = std::make_unique<pacemaker::Refill>();
+				refill->set_period(pacemaker::to_unit(buffer_size, sample_rate));
+			}
+
+			return *refill;
+		}
+
+		// Allow playing loop tables. Tables are set with `LoopPath::play` and
+		// can be replaced at any time.
+		pacemaker::LoopPath& enable_loop() {
+			if (not loop) {
+				loop = std::make_unique<pacemaker::LoopPath>();
+			}
+
+			return *loop;
+		}
+
+		// Accept commands from a `ControlSocket`.
+		pacemaker::ControlPath& enable_control() {
+			if (not control) {
+				control = std::make_unique<pacemaker::ControlPath>();
+			}
+
+			return *control;
+		}
+
+		// Touch every page of the memory the process callback uses so it
+		// doesn't take page faults once running. Only call before `ready()`.
+		void prefault() {
+			for (auto* table: { &ports, &inputs }) {
+				for (auto& port: *table) {
+					pacemaker::prefault(port.queue.get(), sizeof(*port.queue));
+				}
+			}
+
+			if (capture) {
+				pacemaker::prefault(capture.get(), sizeof(*capture));
+			}
+
+			if (thru) {
+				pacemaker::prefault(thru.get(), sizeof(*thru));
+			}
+
+			if (control) {
+				pacemaker::prefault(control.get(), sizeof(*control));
+			}
 		}
 
 		bool port_is_mine(const JackPort& port) const {
-			return jack_port_is_mine(client, port);
+			return backend->port_is_mine(port.get());
+		}
+
+		// Current time in the same domain as event timestamps.
+		pacemaker::Unit now() const {
+			return backend->now();
 		}
 
 		// Start processing MIDI (activates the user callback).
 		bool ready() const {
-			bool is_fail = PACEMAKER_DBG(jack_activate(client));
-			return not(is_fail);
+			return backend->activate();
+		}
+
+		// Stop processing MIDI, the callbacks don't run again once this
+		// returns.
+		void stop() const {
+			backend->deactivate();
 		}
 
 		// TODO: List all ports
 		std::vector<std::string> get_ports(const std::string& name = "") const {
-			return detail::null_array_to_vec<const char*, std::string>(
-				jack_get_ports, client, name.c_str(), JACK_DEFAULT_MIDI_TYPE, 0);
+			return backend->get_ports(name, 0);
 		}
 
 		std::vector<std::string> get_input_ports(const std::string& name = "") const {
-			return detail::null_array_to_vec<const char*, std::string>(
-				jack_get_ports, client, name.c_str(), JACK_DEFAULT_MIDI_TYPE, JackPortIsInput);
+			return backend->get_ports(name, JackPortIsInput);
 		}
 
 		std::vector<std::string> get_output_ports(const std::string& name = "") const {
-			return detail::null_array_to_vec<const char*, std::string>(
-				jack_get_ports, client, name.c_str(), JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput);
+			return backend->get_ports(name, JackPortIsOutput);
 		}
 
 		std::vector<std::string> get_my_ports() const {
-			return detail::null_array_to_vec<const char*, std::string>(
-				jack_get_ports, client, STR_CLIENT_NAME, JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput);
+			return backend->get_ports(STR_CLIENT_NAME, JackPortIsOutput);
 		}
 	};
 
 	// JackPort member function definitions
 	JackPort::~JackPort() {
-		jack_ringbuffer_free(buffer);
-		PACEMAKER_DBG(jack_port_unregister(client->get(), port));
+		if (client and port) {
+			client->backend->port_unregister(port);
+		}
 	}
 
 	bool JackPort::connect(const std::string& dst) const {
-		bool is_fail = PACEMAKER_DBG(jack_connect(client->get(), jack_port_name(port), dst.c_str()));
-		return not(is_fail);
+		return client->backend->port_connect(port, dst);
 	}
 
 	bool JackPort::disconnect(const std::string& dst) const {
-		bool is_fail = PACEMAKER_DBG(jack_disconnect(client->get(), jack_port_name(port), dst.c_str()));
-		return not(is_fail);
+		return client->backend->port_disconnect(port, dst);
 	}
 
 	bool JackPort::rename(const std::string& name) const {
-		bool is_fail = jack_port_rename(client->get(), port, name.c_str());
-		return not(is_fail);
+		return client->backend->port_rename(port, name);
 	}
 
 	int JackPort::connected() const {
-		return jack_port_connected(port);
+		return client->backend->port_connected(port);
 	}
 
 	std::vector<std::string> JackPort::get_connections() const {
-		return detail::null_array_to_vec<const char*, std::string>(jack_port_get_connections, port);
+		return client->backend->port_connections(port);
 	}
 
 	void* JackPort::get_buffer(jack_nframes_t frames) const {
-		return jack_port_get_buffer(port, frames);
+		return client->backend->port_buffer(port, frames);
 	}
 
-	bool JackPort::send(const char* data, size_t count) {
-		if (jack_ringbuffer_write_space(buffer) < count) {
-			return false;
-		}
+	// Events must be sent in timestamp order.
+	bool JackPort::send(const pacemaker::Event& ev) {
+		return queue->push(ev);
+	}
 
-		return count == jack_ringbuffer_write(buffer, data, count);
+	// Returns the number of events that fit in the queue.
+	size_t JackPort::send(const pacemaker::Event* first, size_t count) {
+		return queue->push(first, count);
 	}
 
 	// Callbacks
 	namespace detail {
+		// Map a timestamp onto a frame offset inside of the current cycle.
+		// Events that are already late are placed at the start of the cycle
+		// and events belonging to a later cycle return `false`.
+		inline bool frame_offset(jack_nframes_t& offset,
+			pacemaker::Unit timestamp,
+			jack_time_t current_usecs,
+			jack_time_t next_usecs,
+			jack_nframes_t nframes) {
+			auto usecs = static_cast<jack_time_t>(timestamp.count());
+
+			if (usecs >= next_usecs) {
+				return false;
+			}
+
+			if (usecs <= current_usecs) {
+				offset = 0;
+				return true;
+			}
+
+			offset = static_cast<jack_nframes_t>((usecs - current_usecs) * nframes / (next_usecs - current_usecs));
+			return true;
+		}
+
+		// Offset of the frame `timestamp` falls on relative to the start of
+		// the current cycle, negative or past the cycle if it's outside of
+		// it. Agrees with `frame_offset` for timestamps inside of the cycle.
+		inline int64_t scheduled_offset(
+			pacemaker::Unit timestamp, jack_time_t current_usecs, jack_time_t next_usecs, jack_nframes_t nframes) {
+			int64_t delta = timestamp.count() - static_cast<int64_t>(current_usecs);
+			return detail::floor_div(delta * nframes, static_cast<int64_t>(next_usecs - current_usecs));
+		}
+
+		// Inverse of `frame_offset`, the time of a frame inside of the current
+		// cycle.
+		inline pacemaker::Unit offset_time(
+			jack_nframes_t offset, jack_time_t current_usecs, jack_time_t next_usecs, jack_nframes_t nframes) {
+			jack_time_t period = next_usecs - current_usecs;
+			return pacemaker::Unit { static_cast<int64_t>(current_usecs + offset * period / nframes) };
+		}
+
+		// Read every event on the client's input ports once, stamping it for
+		// the capture queue and running it through the thru rules (if either
+		// is enabled).
+		inline void read_inputs(JackClient& client,
+			const CompiledThru* rules,
+			const CycleTimes& times,
+			jack_nframes_t nframes,
+			CycleStats::Cycle& cycle) {
+			PACEMAKER_SPAN("read_inputs");
+
+			auto& backend = *client.backend;
+			size_t n_outputs = client.ports.size();
+
+			// Pattern events triggered earlier go first, so a note off due at
+			// the same offset as the next note on precedes it.
+			if (rules) {
+				cycle.thru_dropped += client.thru->flush(times.current_frames, nframes);
+			}
+
+			for (size_t i = 0, n = client.inputs.size(); i != n; ++i) {
+				void* buffer = client.inputs[i].get_buffer(nframes);
+				uint32_t count = backend.midi_event_count(buffer);
+
+				for (uint32_t j = 0; j != count; ++j) {
+					CaptureRecord record {};
+					jack_nframes_t offset;
+
+					if (not backend.midi_read(buffer, j, offset, record.midi)) {
+						continue;
+					}
+
+					if (client.capture) {
+						record.timestamp = offset_time(offset, times.current_usecs, times.next_usecs, nframes);
+						record.frame = times.current_frames + offset;
+						record.port = static_cast<PortIndex>(i);
+
+						if (client.capture->push(record)) {
+							++cycle.captured;
+						}
+						else {
+							++cycle.capture_overflows;
+						}
+					}
+
+					if (rules) {
+						auto out = [&](const pacemaker::Midi& midi, PortIndex port, pacemaker::Unit delay) {
+							if (port >= n_outputs) {
+								return false;
+							}
+
+							if (delay.count() == 0) {
+								return client.thru->push(offset, midi, port);
+							}
+
+							auto period = static_cast<int64_t>(times.next_usecs - times.current_usecs);
+							auto frames = static_cast<jack_nframes_t>(delay.count() * nframes / period);
+
+							return client.thru->defer(times.current_frames + offset + frames, midi, port);
+						};
+
+						rules->apply(i, record.midi, [&](const auto& midi, auto port, auto delay) {
+							if (not out(midi, port, delay)) {
+								++cycle.thru_dropped;
+							}
+						});
+					}
+				}
+			}
+
+			// Steps triggered in this cycle may be due in it as well.
+			if (rules) {
+				cycle.thru_dropped += client.thru->flush(times.current_frames, nframes);
+				client.thru->sort();
+			}
+		}
+
+		// Write every event from `queue` that is due in the current cycle using
+		// `write(offset, event)`, which returns `false` once the output is full.
+		// Separate from the process callback so it can be driven without JACK.
+		template <typename F>
+		inline size_t drain_queue(
+			EventQueue& queue, jack_time_t current_usecs, jack_time_t next_usecs, jack_nframes_t nframes, F&& write) {
+			// Stopping early leaves events due in a later cycle queued.
+			return queue.consume([&](const pacemaker::Event& ev) {
+				jack_nframes_t offset;
+
+				if (not frame_offset(offset, ev.timestamp, current_usecs, next_usecs, nframes)) {
+					return false;
+				}
+
+				return write(offset, ev);
+			});
+		}
+
 		inline int process_callback(jack_nframes_t nframes, void* arg) {
+			detail::RtScope rt;
+
+			// JACK runs its other callbacks on threads of their own, so the
+			// process thread is only known once it runs its first cycle.
+			if (not is_process_thread) {
+				is_process_thread = true;
+
+				pacemaker::trace_thread_name("process");
+				pacemaker::prefault_stack();
+			}
+
+			PACEMAKER_SPAN("process_callback");
+
 			auto& client = detail::to_conn(arg);
+			auto& backend = *client.backend;
 			auto& ports = client.ports;
 
-			for (auto& port: ports) {
+			auto start = std::chrono::steady_clock::now();
+
+			CycleTimes times;
+
+			if (not backend.cycle_times(times)) {
+				return 1;
+			}
+
+			CycleStats::Cycle cycle {};
+
+			// Offset in this cycle an event due at `timestamp` belongs at.
+			auto scheduled = [&](pacemaker::Unit timestamp) {
+				return scheduled_offset(timestamp, times.current_usecs, times.next_usecs, nframes);
+			};
+
+			// Ports muted from the control plane only let note offs through.
+			uint64_t muted = client.control ? client.control->apply() : 0;
+
+			// Thru events are sorted by port so each port's share is the range
+			// starting at `next_thru`.
+			const CompiledThru* rules = client.thru ? client.thru->rules.acquire() : nullptr;
+			const ThruEvent* next_thru = nullptr;
+			const ThruEvent* last_thru = nullptr;
+
+			if (rules) {
+				client.thru->count = 0;
+			}
+
+			if (client.capture or rules) {
+				read_inputs(client, rules, times, nframes, cycle);
+			}
+
+			if (rules) {
+				next_thru = client.thru->events.data();
+				last_thru = next_thru + client.thru->count;
+			}
+
+			// Loop events due in this cycle start at `loop_from`. Starting
+			// where the last cycle ended means an event is neither skipped nor
+			// repeated when cycle times jitter a little.
+			const CompiledLoop* loop = client.loop ? client.loop->table.acquire() : nullptr;
+			pacemaker::Unit loop_from {};
+
+			if (loop and not loop->ports.empty()) {
+				pacemaker::Unit current { static_cast<int64_t>(times.current_usecs) };
+				pacemaker::Unit next { static_cast<int64_t>(times.next_usecs) };
+				pacemaker::Unit until = client.loop->until;
+
+				loop_from = until > current - (next - current) and until < next ? until : current;
+				client.loop->until = next;
+			}
+			else {
+				loop = nullptr;
+			}
+
+			for (size_t i = 0, n = ports.size(); i != n; ++i) {
+				PACEMAKER_SPAN("drain");
+
+				auto& port = ports[i];
+
 				void* buffer = port.get_buffer(nframes);
-				jack_midi_clear_buffer(buffer);
+				backend.midi_clear(buffer);
 
-				size_t count = jack_ringbuffer_read_space(port.buffer);
+				// This port's share of the loop.
+				const LoopView* port_loop = nullptr;
+				LoopCursor next_loop {};
+				jack_nframes_t loop_offset = 0;
 
-				if (not count) {  // No events.
-					return 0;
+				if (loop and i < loop->ports.size() and loop->ports[i].size != 0) {
+					port_loop = &loop->ports[i];
+					next_loop = port_loop->seek(loop_from);
 				}
 
-				jack_midi_data_t* midi = jack_midi_event_reserve(buffer, 0, count);
+				// Whether this port's next loop event is in this cycle.
+				auto find_loop = [&] {
+					return port_loop and frame_offset(loop_offset,
+						port_loop->at(next_loop).timestamp,
+						times.current_usecs,
+						times.next_usecs,
+						nframes);
+				};
+
+				bool has_loop = find_loop();
+
+				// Write this port's thru and loop events up to and including
+				// `offset`, merged by offset.
+				auto write_extra = [&](jack_nframes_t offset) {
+					while (true) {
+						bool has_thru = next_thru != last_thru and next_thru->port == i and next_thru->offset <= offset;
+						bool is_loop_due = has_loop and loop_offset <= offset;
+
+						if (has_thru and (not is_loop_due or next_thru->offset <= loop_offset)) {
+							if (backend.midi_write(buffer, next_thru->offset, next_thru->midi)) {
+								++cycle.thru;
+							}
+							else {
+								++cycle.thru_dropped;
+							}
+
+							++next_thru;
+						}
+						else if (is_loop_due) {
+							pacemaker::Midi midi = port_loop->at(next_loop).midi;
+
+							if (pacemaker::is_muted(muted, i, midi)) {
+								++cycle.muted;
+							}
+							else if (backend.midi_write(buffer, loop_offset, midi)) {
+								++cycle.looped;
+
+								cycle.frame_error(loop_offset - scheduled(port_loop->at(next_loop).timestamp));
+							}
+							else {
+								++cycle.loop_dropped;
+							}
+
+							port_loop->advance(next_loop);
+							has_loop = find_loop();
+						}
+						else {
+							break;
+						}
+					}
+				};
+
+				drain_queue(*port.queue,
+					times.current_usecs,
+					times.next_usecs,
+					nframes,
+					[&](jack_nframes_t offset, const pacemaker::Event& ev) {
+						write_extra(offset);
+
+						if (pacemaker::is_muted(muted, i, ev.midi)) {
+							++cycle.muted;
+							return true;
+						}
+
+						// MIDI buffer is full, try again next cycle.
+						if (not backend.midi_write(buffer, offset, ev.midi)) {
+							++cycle.deferred;
+							return false;
+						}
+
+						auto usecs = static_cast<jack_time_t>(ev.timestamp.count());
+
+						if (usecs < times.current_usecs) {
+							++cycle.late;
+							uint64_t lateness = times.current_usecs - usecs;
+							cycle.max_lateness_usecs = std::max(cycle.max_lateness_usecs, lateness);
+						}
+
+						++cycle.emitted;
+						cycle.frame_error(offset - scheduled(ev.timestamp));
+
+						return true;
+					});
+
+				write_extra(nframes);
+
+				cycle.queue_depth += port.queue->size();
+			}
 
-				if (not midi) {
-					return 1;
-				}
+			// Loop events for ports that don't exist have nowhere to go.
+			for (size_t i = ports.size(); loop and i < loop->ports.size(); ++i) {
+				auto& view = loop->ports[i];
+				jack_nframes_t offset = 0;
 
-				// This will automatically advance the internal data pointer of the ringbuffer and we don't need to
-				// handle the case of data wrapping across the end boundary.
-				size_t count_copied = jack_ringbuffer_read(port.buffer, reinterpret_cast<char*>(midi), count);
+				if (view.size == 0) {
+					continue;
+				}
 
-				if (count_copied != count) {
-					return 1;
+				for (LoopCursor c = view.seek(loop_from);
+					frame_offset(offset, view.at(c).timestamp, times.current_usecs, times.next_usecs, nframes);
+					view.advance(c)) {
+					++cycle.loop_dropped;
 				}
 			}
 
+			if (client.refill) {
+				client.refill->check(pacemaker::Unit { static_cast<int64_t>(times.current_usecs) },
+					pacemaker::Unit { static_cast<int64_t>(times.next_usecs) });
+			}
+
+			client.stats.record(cycle, std::chrono::steady_clock::now() - start, backend.cpu_load());
+
 			return 0;
 		}
 
 		inline int sample_rate_callback(jack_nframes_t new_sample_rate, void* arg) {
+			detail::RtScope rt;
+
+			PACEMAKER_INSTANT("sample_rate_changed");
 			PACEMAKER_LOG(LogLevel::WRN, "sample rate changed");
-			detail::to_conn(arg).sample_rate = new_sample_rate;
+
+			auto& client = detail::to_conn(arg);
+			client.sample_rate = new_sample_rate;
+
+			if (client.refill) {
+				client.refill->set_period(pacemaker::to_unit(client.buffer_size, new_sample_rate));
+			}
+
 			return 0;
 		}
 
 		inline int buffer_size_callback(jack_nframes_t new_buffer_size, void* arg) {
+			detail::RtScope rt;
+
+			PACEMAKER_INSTANT("buffer_size_changed");
 			PACEMAKER_LOG(LogLevel::WRN, "buffer size changed");
-			detail::to_conn(arg).buffer_size = new_buffer_size;
+
+			auto& client = detail::to_conn(arg);
+			client.buffer_size = new_buffer_size;
+
+			// The lookahead has to cover a couple of the new periods.
+			if (client.refill) {
+				client.refill->set_period(pacemaker::to_unit(new_buffer_size, client.sample_rate));
+			}
+
 			return 0;
 		}
 
 		inline void client_registration_callback(const char* client, int is_registering, void*) {
+			detail::RtScope rt;
+
 			constexpr std::array states { "unregistering", "registering" };
 			PACEMAKER_LOG(LogLevel::WRN, client, " is ", states.at(is_registering));
 		}
 
 		inline void port_connect_callback(jack_port_id_t a, jack_port_id_t b, int is_connecting, void* arg) {
+			detail::RtScope rt;
+
 			constexpr std::array states { "disconnecting from", "connecting to" };
 
-			jack_port_t* port_a = jack_port_by_id(detail::to_conn(arg), a);
-			jack_port_t* port_b = jack_port_by_id(detail::to_conn(arg), b);
+			auto& backend = *detail::to_conn(arg).backend;
 
-			const char* port_name_a = jack_port_name(port_a);
-			const char* port_name_b = jack_port_name(port_b);
+			const char* port_name_a = backend.port_name(a);
+			const char* port_name_b = backend.port_name(b);
 
 			PACEMAKER_LOG(LogLevel::WRN, port_name_a, " is ", states.at(is_connecting), " ", port_name_b);
 		}
 
 		inline void port_registration_callback(jack_port_id_t port_id, int is_registering, void* arg) {
+			detail::RtScope rt;
+
 			// TODO: Check if any of our known ports unregistered.
 
 			constexpr std::array states { "unregistering", "registering" };
 
-			jack_port_t* port = jack_port_by_id(detail::to_conn(arg), port_id);
-			const char* port_name = jack_port_name(port);
+			const char* port_name = detail::to_conn(arg).backend->port_name(port_id);
 
 			PACEMAKER_LOG(LogLevel::WRN, port_name, " is ", states.at(is_registering));
 		}
 
 		inline void port_rename_callback(jack_port_id_t port, const char* old_name, const char* new_name, void*) {
+			detail::RtScope rt;
+
 			PACEMAKER_LOG(LogLevel::WRN, port, " is renaming from ", old_name, " to ", new_name);
 		}
 
 		inline int xrun_callback(void* arg) {
-			float usecs = jack_get_xrun_delayed_usecs(detail::to_conn(arg));
+			detail::RtScope rt;
+
+			float usecs = detail::to_conn(arg).backend->xrun_delayed_usecs();
+			detail::to_conn(arg).stats.record_xrun(usecs);
+			PACEMAKER_INSTANT("xrun");
+
 			PACEMAKER_LOG(LogLevel::WRN, "xrun occured with delay of ", usecs, "μs");
 			return 0;
 		}
@@ -0,0 +1,215 @@
+#ifndef PACEMAKER_LOOP_HPP
+#define PACEMAKER_LOOP_HPP
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <pacemaker/timing.hpp>
+#include <pacemaker/swap.hpp>
+#include <pacemaker/sequencer.hpp>
+
+// Patches that never change, like clocks and click tracks, repeat exactly
+// after a while. Such a patch can be expanded into a table of one loop of
+// events at compile time and played by looking up the table by phase, with
+// no generation at all at run time.
+namespace pacemaker {
+	namespace detail {
+		// Every channel repeats after `frequency * notes.size()`, the whole
+		// patch after the least common multiple of those. Zero if no channel
+		// has notes.
+		constexpr pacemaker::Unit loop_length(const pacemaker::Patch& p) {
+			int64_t length = 0;
+
+			for (auto& ch: p) {
+				if (ch.notes.empty()) {
+					continue;
+				}
+
+				int64_t cycle = ch.frequency.count() * static_cast<int64_t>(ch.notes.size());
+				length = length == 0 ? cycle : std::lcm(length, cycle);
+			}
+
+			return pacemaker::Unit { length };
+		}
+
+		constexpr size_t loop_event_count(const pacemaker::Patch& p) {
+			auto length = loop_length(p);
+			size_t count = 0;
+
+			for (auto& ch: p) {
+				if (not ch.notes.empty()) {
+					count += detail::events_between(pacemaker::Unit { 0 }, length, ch.frequency, ch.offset);
+				}
+			}
+
+			return count;
+		}
+	}  // namespace detail
+
+	// Position within a `LoopView`: the event at `index` of the loop that
+	// starts at `base`.
+	struct LoopCursor {
+		size_t index;
+		pacemaker::Unit base;
+	};
+
+	// One loop of events in timestamp order, starting at time zero. Only
+	// refers to the events so it can be handed around freely, the table
+	// it comes from usually has static storage.
+	struct LoopView {
+		const pacemaker::Event* events = nullptr;
+		size_t size = 0;
+		pacemaker::Unit length {};
+
+		// First event at or after `t`.
+		constexpr LoopCursor seek(pacemaker::Unit t) const {
+			pacemaker::Unit base { detail::floor_div(t.count(), length.count()) * length.count() };
+
+			const pacemaker::Event* it = std::lower_bound(events, events + size, t - base, [](auto& ev, auto x) {
+				return ev.timestamp < x;
+			});
+
+			if (it == events + size) {
+				return { 0, base + length };
+			}
+
+			return { static_cast<size_t>(it - events), base };
+		}
+
+		// Event at `cursor` in absolute time.
+		constexpr pacemaker::Event at(const LoopCursor& cursor) const {
+			auto& ev = events[cursor.index];
+			return { cursor.base + ev.timestamp, ev.midi, ev.port };
+		}
+
+		constexpr void advance(LoopCursor& cursor) const {
+			if (++cursor.index == size) {
+				cursor.index = 0;
+				cursor.base += length;
+			}
+		}
+
+		// Call `fn(event)` for every event in [begin, end).
+		template <typename F>
+		constexpr void between(pacemaker::Unit begin, pacemaker::Unit end, F&& fn) const {
+			if (size == 0) {
+				return;
+			}
+
+			for (LoopCursor cursor = seek(begin);; advance(cursor)) {
+				pacemaker::Event ev = at(cursor);
+
+				if (ev.timestamp >= end) {
+					break;
+				}
+
+				fn(ev);
+			}
+		}
+	};
+
+	template <size_t N>
+	struct LoopTable {
+		pacemaker::Unit length;
+		std::array<pacemaker::Event, N> events;
+
+		constexpr LoopView view() const {
+			return { events.data(), N, length };
+		}
+	};
+
+	// Expand one loop of the patch returned by `make_patch`, which must be
+	// callable at compile time. The events are in the same order as
+	// `timeline()` produces them.
+	//
+	//     static constexpr auto click = pacemaker::loop_table([] {
+	//         return pacemaker::Patch { ... };
+	//     });
+	template <typename F>
+	consteval auto loop_table(F make_patch) {
+		constexpr size_t N = detail::loop_event_count(F {}());
+
+		pacemaker::Patch p = make_patch();
+		LoopTable<N> table { detail::loop_length(p), {} };
+
+		size_t n = 0;
+
+		for (auto& [st, frequency, offset, ns, port]: p) {
+			if (ns.empty()) {
+				continue;
+			}
+
+			auto status = static_cast<MidiStatus>(st.channel | st.function);
+
+			int64_t first = detail::event_index(pacemaker::Unit { 0 }, frequency, offset);
+			size_t count = detail::events_between(pacemaker::Unit { 0 }, table.length, frequency, offset);
+
+			for (size_t i = 0; i != count; ++i) {
+				int64_t k = first + static_cast<int64_t>(i);
+				auto note = ns[static_cast<size_t>(detail::phase(k, static_cast<int64_t>(ns.size())))];
+
+				table.events[n++] = { offset + frequency * k, pacemaker::Midi { status, note, 127 }, port };
+			}
+		}
+
+		std::sort(table.events.begin(), table.events.end());
+
+		return table;
+	}
+
+	// A loop split up by port when it's played, so each port only walks its
+	// own events. Every port's share is a loop of the same length on its
+	// own, empty for ports without events.
+	struct CompiledLoop {
+		std::vector<std::vector<pacemaker::Event>> events;
+		std::vector<pacemaker::LoopView> ports;
+
+		CompiledLoop() = default;
+
+		explicit CompiledLoop(const pacemaker::LoopView& view) {
+			for (size_t i = 0; i != view.size; ++i) {
+				auto& ev = view.events[i];
+
+				if (ev.port >= events.size()) {
+					events.resize(ev.port + 1u);
+				}
+
+				events[ev.port].push_back(ev);
+			}
+
+			ports.reserve(events.size());
+
+			for (auto& es: events) {
+				ports.push_back({ es.data(), es.size(), view.length });
+			}
+		}
+
+		// `ports` points into `events`.
+		CompiledLoop(const CompiledLoop&) = delete;
+		CompiledLoop& operator=(const CompiledLoop&) = delete;
+	};
+
+	// Loop played by the process callback alongside the queued events.
+	struct LoopPath {
+		pacemaker::HotSwap<const pacemaker::CompiledLoop> table;
+
+		// End of the last cycle the loop was played in, so consecutive cycles
+		// pick up exactly where the last one left off. Only touched by the
+		// process callback.
+		pacemaker::Unit until {};
+
+		// Start playing `view`, picked up at the start of the next cycle. An
+		// empty view stops. Allocates, so not for the process callback.
+		void play(const pacemaker::LoopView& view) {
+			table.publish(std::make_unique<const pacemaker::CompiledLoop>(view));
+		}
+	};
+}  // namespace pacemaker
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef PACEMAKER_MAPPED_HPP
+#define PACEMAKER_MAPPED_HPP
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include <pacemaker/util.hpp>
+#include <pacemaker/timing.hpp>
+#include <pacemaker/sequencer.hpp>
+#include <pacemaker/render.hpp>
+
+// Precomputed timelines for playing back long fixed arrangements without
+// generating anything. The file is a `TimelineHeader`, the events as raw
+// `Event` records in timestamp order and finally an index holding the
+// timestamp of every `index_stride`th event. Everything is in the host's
+// byte order and naturally aligned so the file can be used in place once
+// mapped.
+namespace pacemaker {
+	constexpr uint32_t TIMELINE_INDEX_STRIDE = 1'024;
+
+	struct TimelineHeader {
+		std::array<char, 8> magic;
+		uint32_t version;
+		uint32_t record_size;
+		uint32_t index_stride;
+
+		// Output ports needed to play every event.
+		uint32_t ports;
+
+		uint64_t count;
+		uint64_t index_offset;
+
+		// Range the events were rendered from.
+		int64_t begin;
+		int64_t end;
+	};
+
+	static_assert(sizeof(TimelineHeader) == 56);
+	static_assert(std::is_trivially_copyable_v<TimelineHeader>);
+
+	constexpr std::array<char, 8> TIMELINE_MAGIC { 'P', 'M', 'T', 'I', 'M', 'E', 'L', 'N' };
+	constexpr uint32_t TIMELINE_VERSION = 1;
+
+	// Render [begin, end) of a patch as a timeline file. The stream must be
+	// seekable because the header is only complete at the end. Returns the
+	// number of events written, a stream that fails on the way is a fatal
+	// error.
+	inline size_t write_timeline(std::ostream& os,
+		pacemaker::Unit begin,
+		pacemaker::Unit end,
+		const pacemaker::Patch& p,
+		uint32_t index_stride = TIMELINE_INDEX_STRIDE) {
+		TimelineHeader header {
+			TIMELINE_MAGIC,
+			TIMELINE_VERSION,
+			sizeof(pacemaker::Event),
+			index_stride,
+			0,
+			0,
+			0,
+			begin.count(),
+			end.count(),
+		};
+
+		auto header_pos = os.tellp();
+
+		if (header_pos == std::ostream::pos_type(-1)) {
+			pacemaker::fatal_error("timelines can only be written to seekable files");
+		}
+
+		os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		std::vector<int64_t> index;
+
+		detail::render_windows(begin, end, p, [&](const pacemaker::Event& ev) {
+			if (header.count % index_stride == 0) {
+				index.push_back(ev.timestamp.count());
+			}
+
+			header.ports = std::max<uint32_t>(header.ports, ev.port + 1u);
+
+			os.write(reinterpret_cast<const char*>(&ev), sizeof(ev));
+			++header.count;
+		});
+
+		header.index_offset = sizeof(header) + header.count * sizeof(pacemaker::Event);
+		auto index_size = static_cast<std::streamsize>(index.size() * sizeof(int64_t));
+		os.write(reinterpret_cast<const char*>(index.data()), index_size);
+
+		auto end_pos = os.tellp();
+		os.seekp(header_pos);
+		os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		os.seekp(end_pos);
+
+		if (not os) {
+			pacemaker::fatal_error("could not write the timeline");
+		}
+
+		return header.count;
+	}
+
+	// Read-only mapping of a timeline file. Events are used straight from
+	// the mapping and the kernel is told they're read sequentially, so
+	// pages that have been played can be dropped and memory use stays flat
+	// however long the arrangement is.
+	struct MappedTimeline {
+		void* data;
+		size_t length;
+
+		TimelineHeader header;
+
+		const pacemaker::Event* events;
+		const int64_t* index;
+		size_t index_count;
+
+		explicit MappedTimeline(const std::string& path): data(nullptr), length(0) {
+			int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+			if (fd < 0) {
+				pacemaker::fatal_error("could not open `", path, "`: ", std::strerror(errno));
+			}
+
+			struct stat st;
+
+			if (::fstat(fd, &st) != 0 or static_cast<size_t>(st.st_size) < sizeof(TimelineHeader)) {
+				::close(fd);
+				pacemaker::fatal_error("`", path, "` is not a timeline file");
+			}
+
+			length = static_cast<size_t>(st.st_size);
+			data = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+			int error = errno;
+			::close(fd);
+
+			if (data == MAP_FAILED) {
+				data = nullptr;
+				pacemaker::fatal_error("could not map `", path, "`: ", std::strerror(error));
+			}
+
+			::madvise(data, length, MADV_SEQUENTIAL);
+
+			std::memcpy(&header, data, sizeof(header));
+
+			index_count = header.index_stride == 0 ?
+				0 :
+				static_cast<size_t>((header.count + header.index_stride - 1) / header.index_stride);
+
+			if (not is_valid()) {
+				::munmap(data, length);
+				data = nullptr;
+				pacemaker::fatal_error("`", path, "` is not a timeline file");
+			}
+
+			auto* bytes = static_cast<const std::byte*>(data);
+
+			events = reinterpret_cast<const pacemaker::Event*>(bytes + sizeof(TimelineHeader));
+			index = reinterpret_cast<const int64_t*>(bytes + header.index_offset);
+		}
+
+		~MappedTimeline() {
+			if (data) {
+				::munmap(data, length);
+			}
+		}
+
+		MappedTimeline(const MappedTimeline&) = delete;
+		MappedTimeline& operator=(const MappedTimeline&) = delete;
+
+		bool is_valid() const {
+			if (header.magic != TIMELINE_MAGIC or header.version != TIMELINE_VERSION or
+				header.record_size != sizeof(pacemaker::Event) or header.index_stride == 0) {
+				return false;
+			}
+
+			return header.count <= length / sizeof(pacemaker::Event) and
+				header.index_offset == sizeof(TimelineHeader) + header.count * sizeof(pacemaker::Event) and
+				length == header.index_offset + index_count * sizeof(int64_t);
+		}
+
+		size_t size() const {
+			return static_cast<size_t>(header.count);
+		}
+
+		const pacemaker::Event* begin() const {
+			return events;
+		}
+
+		const pacemaker::Event* end() const {
+			return events + size();
+		}
+
+		// First event at or after `timestamp`. The index narrows the search
+		// down to a single stride so only one or two pages of events are
+		// touched.
+		const pacemaker::Event* seek(pacemaker::Unit timestamp) const {
+			const int64_t* entry = std::lower_bound(index, index + index_count, timestamp.count());
+
+			if (entry == index) {
+				return events;
+			}
+
+			size_t first = static_cast<size_t>(entry - index - 1) * header.index_stride;
+			size_t last = std::min(first + header.index_stride + 1, size());
+
+			return std::lower_bound(events + first,
+				events + last,
+				timestamp,
+				[](const pacemaker::Event& ev, pacemaker::Unit t) { return ev.timestamp < t; });
+		}
+
+		// Events in [first, last).
+		std::span<const pacemaker::Event> between(pacemaker::Unit first, pacemaker::Unit last) const {
+			const pacemaker::Event* lo = seek(first);
+			const pacemaker::Event* hi = seek(last);
+
+			return { lo, static_cast<size_t>(std::max<std::ptrdiff_t>(hi - lo, 0)) };
+		}
+	};
+}  // namespace pacemaker
+
+#endif
@@ -3,7 +3,25 @@
 
 #include <pacemaker/const.hpp>
 #include <pacemaker/util.hpp>
+#include <pacemaker/queue.hpp>
+#include <pacemaker/timing.hpp>
+#include <pacemaker/swap.hpp>
+#include <pacemaker/stats.hpp>
+#include <pacemaker/trace.hpp>
+#include <pacemaker/capture.hpp>
+#include <pacemaker/thru.hpp>
+#include <pacemaker/refill.hpp>
+#include <pacemaker/rt.hpp>
+#include <pacemaker/backend.hpp>
 #include <pacemaker/jack.hpp>
+#include <pacemaker/fake.hpp>
 #include <pacemaker/sequencer.hpp>
+#include <pacemaker/arena.hpp>
+#include <pacemaker/batch.hpp>
+#include <pacemaker/wheel.hpp>
+#include <pacemaker/loop.hpp>
+#include <pacemaker/control.hpp>
+#include <pacemaker/render.hpp>
+#include <pacemaker/mapped.hpp>
 
 #endif
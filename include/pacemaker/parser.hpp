@@ -0,0 +1,258 @@
+#ifndef PACEMAKER_PARSER_HPP
+#define PACEMAKER_PARSER_HPP
+
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+#include <lexy/action/parse.hpp>
+#include <lexy/callback.hpp>
+#include <lexy/dsl.hpp>
+#include <lexy/input/string_input.hpp>
+#include <lexy/input_location.hpp>
+
+#include <pacemaker/const.hpp>
+#include <pacemaker/util.hpp>
+#include <pacemaker/timing.hpp>
+#include <pacemaker/sequencer.hpp>
+
+// Parser for the patch language in `docs/grammar.ebnf`. Every line that
+// isn't blank or a comment describes a channel as a comma separated list of
+// commands:
+//
+//   on [64 67], every 2s, offset 500ms, channel 1, port 2  # comment
+//
+// The channel is built while parsing, lexemes are never copied and the only
+// allocations are the patch itself and each channel's notes.
+namespace pacemaker {
+	namespace grammar {
+		namespace dsl = lexy::dsl;
+
+		// Changes a single command makes to a channel.
+		struct SetNotes {
+			MidiFunction function;
+			pacemaker::Notes notes;
+		};
+
+		struct SetFrequency {
+			pacemaker::Unit frequency;
+		};
+
+		struct SetOffset {
+			pacemaker::Unit offset;
+		};
+
+		struct SetChannel {
+			MidiChannel channel;
+		};
+
+		struct SetPort {
+			PortIndex port;
+		};
+
+		struct ApplyCommand {
+			void operator()(pacemaker::Channel& ch, SetNotes&& x) const {
+				ch.status.function = x.function;
+				ch.notes = std::move(x.notes);
+			}
+
+			void operator()(pacemaker::Channel& ch, SetFrequency x) const {
+				ch.frequency = x.frequency;
+			}
+
+			void operator()(pacemaker::Channel& ch, SetOffset x) const {
+				ch.offset = x.offset;
+			}
+
+			void operator()(pacemaker::Channel& ch, SetChannel x) const {
+				ch.status.channel = x.channel;
+			}
+
+			void operator()(pacemaker::Channel& ch, SetPort x) const {
+				ch.port = x.port;
+			}
+		};
+
+		// A channel and where its line starts, so problems found after
+		// parsing can still point at the source.
+		struct ParsedChannel {
+			pacemaker::Channel channel;
+			const char* position;
+		};
+
+		struct ParsedPatch {
+			pacemaker::Patch patch;
+			std::vector<const char*> positions;
+		};
+
+		struct AddChannel {
+			void operator()(ParsedPatch&, lexy::nullopt) const {}
+
+			void operator()(ParsedPatch& p, ParsedChannel&& ch) const {
+				p.patch.push_back(std::move(ch.channel));
+				p.positions.push_back(ch.position);
+			}
+		};
+
+		struct unknown_command {
+			static constexpr auto name = "unknown command";
+		};
+
+		constexpr auto identifier = dsl::identifier(dsl::ascii::alpha_underscore, dsl::ascii::alpha_digit_underscore);
+
+		// Microseconds per unit. Units are matched as a whole word so `m` and
+		// `ms` don't clash.
+		constexpr auto time_units = lexy::symbol_table<int64_t>
+										.map<LEXY_SYMBOL("us")>(1)
+										.map<LEXY_SYMBOL("ms")>(1'000)
+										.map<LEXY_SYMBOL("s")>(1'000'000)
+										.map<LEXY_SYMBOL("m")>(60'000'000)
+										.map<LEXY_SYMBOL("hr")>(3'600'000'000);
+
+		// An integer immediately followed by a unit, e.g. `500ms`. The count
+		// is 32 bits so that scaling it to microseconds can't overflow.
+		struct time: lexy::token_production {
+			static constexpr auto rule =
+				dsl::integer<int32_t>(dsl::digits<>) + dsl::symbol<time_units>(dsl::identifier(dsl::ascii::alpha));
+
+			static constexpr auto value = lexy::callback<pacemaker::Unit>(
+				[](int32_t count, int64_t scale) { return pacemaker::Unit { count * scale }; });
+		};
+
+		struct note {
+			static constexpr auto rule = dsl::integer<lexy::bounded<MidiNote, 127>>(dsl::digits<>);
+			static constexpr auto value = lexy::forward<MidiNote>;
+		};
+
+		// Tuple of notes, e.g. `[64 67 71]`.
+		struct notes {
+			static constexpr auto rule = dsl::square_bracketed.list(dsl::peek(dsl::digit<>) >> dsl::p<note>);
+			static constexpr auto value = lexy::as_list<pacemaker::Notes>;
+		};
+
+		struct midi_channel {
+			static constexpr auto rule = dsl::integer<lexy::bounded<MidiChannel, 15>>(dsl::digits<>);
+			static constexpr auto value = lexy::forward<MidiChannel>;
+		};
+
+		struct port_index {
+			static constexpr auto rule = dsl::integer<lexy::bounded<PortIndex, MAX_PORTS - 1>>(dsl::digits<>);
+			static constexpr auto value = lexy::forward<PortIndex>;
+		};
+
+		struct on_command {
+			static constexpr auto rule = LEXY_KEYWORD("on", identifier) >> dsl::p<notes>;
+			static constexpr auto value = lexy::callback<SetNotes>(
+				[](pacemaker::Notes ns) { return SetNotes { MIDI_NOTE_ON, std::move(ns) }; });
+		};
+
+		struct off_command {
+			static constexpr auto rule = LEXY_KEYWORD("off", identifier) >> dsl::p<notes>;
+			static constexpr auto value = lexy::callback<SetNotes>(
+				[](pacemaker::Notes ns) { return SetNotes { MIDI_NOTE_OFF, std::move(ns) }; });
+		};
+
+		struct every_command {
+			static constexpr auto rule = LEXY_KEYWORD("every", identifier) >> dsl::p<time>;
+			static constexpr auto value = lexy::construct<SetFrequency>;
+		};
+
+		struct offset_command {
+			static constexpr auto rule = LEXY_KEYWORD("offset", identifier) >> dsl::p<time>;
+			static constexpr auto value = lexy::construct<SetOffset>;
+		};
+
+		struct channel_command {
+			static constexpr auto rule = LEXY_KEYWORD("channel", identifier) >> dsl::p<midi_channel>;
+			static constexpr auto value = lexy::construct<SetChannel>;
+		};
+
+		struct port_command {
+			static constexpr auto rule = LEXY_KEYWORD("port", identifier) >> dsl::p<port_index>;
+			static constexpr auto value = lexy::construct<SetPort>;
+		};
+
+		// Commands are applied to the channel as soon as they're parsed.
+		struct line {
+			static constexpr auto rule = [] {
+				auto command = dsl::p<on_command> | dsl::p<off_command> | dsl::p<every_command> |
+					dsl::p<offset_command> | dsl::p<channel_command> | dsl::p<port_command> |
+					dsl::error<unknown_command>(identifier);
+
+				return dsl::position + dsl::list(command, dsl::sep(dsl::comma));
+			}();
+
+			static constexpr auto value =
+				lexy::fold_inplace<pacemaker::Channel>(
+					[] {
+						pacemaker::Unit zero { 0 };
+						return pacemaker::Channel { { 0, MIDI_NOTE_ON }, zero, zero, {}, 0 };
+					},
+					ApplyCommand {}) >>
+				lexy::callback<ParsedChannel>([](const char* position, pacemaker::Channel&& ch) {
+					return ParsedChannel { std::move(ch), position };
+				});
+		};
+
+		struct patch {
+			static constexpr auto whitespace = dsl::ascii::blank;
+
+			static constexpr auto rule = [] {
+				auto comment = dsl::hash_sign >> dsl::until(dsl::newline).or_eof();
+				auto line_end = comment | dsl::else_ >> dsl::eol;
+
+				auto item = dsl::opt(dsl::peek(dsl::ascii::alpha_underscore) >> dsl::p<line>) + line_end;
+				return dsl::terminator(dsl::eof).opt_list(item);
+			}();
+
+			static constexpr auto value = lexy::fold_inplace<ParsedPatch>([] { return ParsedPatch {}; },
+											  AddChannel {}) >>
+				lexy::callback<ParsedPatch>(
+					[](ParsedPatch&& p) { return std::move(p); }, [](lexy::nullopt) { return ParsedPatch {}; });
+		};
+	}  // namespace grammar
+
+	// Parse a patch, passing syntax errors to `on_error` which can be any
+	// lexy error callback (e.g. `lexy_ext::report_error`). Channels that would
+	// never produce an event are reported through `pacemaker::error` with the
+	// line they're on. Returns nothing if the source has any errors.
+	template <typename ErrorCallback>
+	inline std::optional<pacemaker::Patch> parse_patch(std::string_view src, ErrorCallback&& on_error) {
+		auto input = lexy::string_input<lexy::default_encoding>(src.data(), src.size());
+		auto result = lexy::parse<grammar::patch>(input, std::forward<ErrorCallback>(on_error));
+
+		if (not result.is_success()) {
+			return std::nullopt;
+		}
+
+		auto [p, positions] = std::move(result).value();
+		bool is_valid = true;
+
+		for (size_t i = 0; i != p.size(); ++i) {
+			auto location = lexy::get_input_location(input, positions[i]);
+			auto line = location.line_nr();
+			auto column = location.column_nr();
+
+			if (p[i].frequency <= pacemaker::Unit { 0 }) {
+				pacemaker::error(line, ":", column, ": channel needs a non-zero `every`");
+				is_valid = false;
+			}
+
+			if (p[i].notes.empty()) {
+				pacemaker::error(line, ":", column, ": channel needs `on` or `off` notes");
+				is_valid = false;
+			}
+		}
+
+		if (not is_valid) {
+			return std::nullopt;
+		}
+
+		return std::move(p);
+	}
+}  // namespace pacemaker
+
+#endif
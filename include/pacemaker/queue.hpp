@@ -0,0 +1,245 @@
+#ifndef PACEMAKER_QUEUE_HPP
+#define PACEMAKER_QUEUE_HPP
+
+#include <atomic>
+#include <array>
+#include <algorithm>
+#include <type_traits>
+
+#include <cstddef>
+
+namespace pacemaker {
+	// `std::hardware_destructive_interference_size` is not ABI stable and
+	// missing from libc++ so we hardcode it.
+	constexpr size_t CACHE_LINE_SIZE = 64;
+
+	// Wait-free single-producer/single-consumer queue.
+	// The producer and consumer indices live on separate cache lines and each
+	// side keeps a cached copy of the other side's index so that the shared
+	// cache line is only touched when the cached value runs out.
+	template <typename T, size_t N>
+	struct SpscQueue {
+		static_assert(N > 0 and (N & (N - 1)) == 0, "capacity must be a power of two");
+		static_assert(std::is_trivially_copyable_v<T>, "elements are copied by value");
+
+		static constexpr size_t MASK = N - 1;
+
+		SpscQueue() = default;
+
+		SpscQueue(const SpscQueue&) = delete;
+		SpscQueue& operator=(const SpscQueue&) = delete;
+
+		// Producer side.
+		bool push(const T& x) {
+			return push(&x, 1) == 1;
+		}
+
+		// Enqueue up to `count` elements, returning how many were actually
+		// enqueued. Anything that doesn't fit is counted as an overflow.
+		size_t push(const T* first, size_t count) {
+			size_t head = producer.head.load(std::memory_order_relaxed);
+			size_t available = N - (head - producer.cached_tail);
+
+			if (available < count) {
+				producer.cached_tail = consumer.tail.load(std::memory_order_acquire);
+				available = N - (head - producer.cached_tail);
+			}
+
+			size_t n = std::min(count, available);
+
+			for (size_t i = 0; i != n; ++i) {
+				data[(head + i) & MASK] = first[i];
+			}
+
+			producer.head.store(head + n, std::memory_order_release);
+
+			// Measured against the cached tail so this may overestimate.
+			size_t used = head + n - producer.cached_tail;
+
+			if (used > stats.high_water_mark.load(std::memory_order_relaxed)) {
+				stats.high_water_mark.store(used, std::memory_order_relaxed);
+			}
+
+			if (n != count) {
+				stats.overflows.fetch_add(count - n, std::memory_order_relaxed);
+			}
+
+			return n;
+		}
+
+		// Consumer side.
+		bool pop(T& x) {
+			return pop(&x, 1) == 1;
+		}
+
+		// Dequeue up to `count` elements into `out`.
+		size_t pop(T* out, size_t count) {
+			size_t n = 0;
+
+			consume([&](const T& x) {
+				if (n == count) {
+					return false;
+				}
+
+				out[n++] = x;
+				return true;
+			});
+
+			return n;
+		}
+
+		// Visit queued elements in order without copying them out. The visitor
+		// returns `false` to stop early and leave the current element (and
+		// everything after it) queued. The consumer index is only published
+		// once, after the batch.
+		template <typename F>
+		size_t consume(F&& fn) {
+			size_t tail = consumer.tail.load(std::memory_order_relaxed);
+			size_t n = 0;
+
+			for (;; ++n) {
+				if (tail + n == consumer.cached_head) {
+					consumer.cached_head = producer.head.load(std::memory_order_acquire);
+
+					if (tail + n == consumer.cached_head) {
+						break;
+					}
+				}
+
+				if (not fn(static_cast<const T&>(data[(tail + n) & MASK]))) {
+					break;
+				}
+			}
+
+			consumer.tail.store(tail + n, std::memory_order_release);
+
+			return n;
+		}
+
+		// Approximate when called from either side while the other is active.
+		size_t size() const {
+			return producer.head.load(std::memory_order_acquire) - consumer.tail.load(std::memory_order_acquire);
+		}
+
+		bool empty() const {
+			return size() == 0;
+		}
+
+		static constexpr size_t capacity() {
+			return N;
+		}
+
+		size_t high_water_mark() const {
+			return stats.high_water_mark.load(std::memory_order_relaxed);
+		}
+
+		size_t overflows() const {
+			return stats.overflows.load(std::memory_order_relaxed);
+		}
+
+		struct alignas(CACHE_LINE_SIZE) Producer {
+			std::atomic<size_t> head = 0;
+			size_t cached_tail = 0;
+		};
+
+		struct alignas(CACHE_LINE_SIZE) Consumer {
+			std::atomic<size_t> tail = 0;
+			size_t cached_head = 0;
+		};
+
+		// Only written by the producer.
+		struct alignas(CACHE_LINE_SIZE) Stats {
+			std::atomic<size_t> high_water_mark = 0;
+			std::atomic<size_t> overflows = 0;
+		};
+
+		Producer producer;
+		Consumer consumer;
+		Stats stats;
+
+		alignas(CACHE_LINE_SIZE) std::array<T, N> data;
+	};
+
+	// Bounded lock-free multi-producer/single-consumer queue.
+	// Each cell carries a sequence number telling producers and the consumer
+	// whose turn it is, so producers only contend on the shared head index.
+	template <typename T, size_t N>
+	struct MpscQueue {
+		static_assert(N > 0 and (N & (N - 1)) == 0, "capacity must be a power of two");
+		static_assert(std::is_trivially_copyable_v<T>, "elements are copied by value");
+
+		static constexpr size_t MASK = N - 1;
+
+		struct Cell {
+			std::atomic<size_t> sequence;
+			T value;
+		};
+
+		MpscQueue() {
+			for (size_t i = 0; i != N; ++i) {
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		MpscQueue(const MpscQueue&) = delete;
+		MpscQueue& operator=(const MpscQueue&) = delete;
+
+		// Producer side, safe to call from any thread.
+		bool push(const T& x) {
+			size_t pos = head.load(std::memory_order_relaxed);
+
+			while (true) {
+				Cell& cell = cells[pos & MASK];
+				size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				auto diff = static_cast<std::ptrdiff_t>(sequence - pos);
+
+				if (diff == 0) {
+					if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						cell.value = x;
+						cell.sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0) {
+					overflow_count.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				else {
+					pos = head.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// Consumer side.
+		bool pop(T& x) {
+			Cell& cell = cells[tail & MASK];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+			if (sequence != tail + 1) {
+				return false;
+			}
+
+			x = cell.value;
+			cell.sequence.store(tail + N, std::memory_order_release);
+			++tail;
+
+			return true;
+		}
+
+		static constexpr size_t capacity() {
+			return N;
+		}
+
+		size_t overflows() const {
+			return overflow_count.load(std::memory_order_relaxed);
+		}
+
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> head = 0;
+		alignas(CACHE_LINE_SIZE) std::atomic<size_t> overflow_count = 0;
+		alignas(CACHE_LINE_SIZE) size_t tail = 0;
+
+		alignas(CACHE_LINE_SIZE) std::array<Cell, N> cells;
+	};
+}  // namespace pacemaker
+
+#endif
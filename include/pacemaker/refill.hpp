@@ -0,0 +1,202 @@
+#ifndef PACEMAKER_REFILL_HPP
+#define PACEMAKER_REFILL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+
+extern "C" {
+#include <semaphore.h>
+}
+
+#include <pacemaker/util.hpp>
+#include <pacemaker/timing.hpp>
+
+// Wakes the thread generating events when the process callback is about to
+// run out of them. Instead of polling, the generator blocks on a semaphore
+// that the process callback posts once the queued lookahead drops below a
+// low-water mark, then generates up to the high-water mark.
+//
+// The marks adapt to the rig: the low-water mark covers a couple of process
+// periods plus the worst recent time the generator took to wake up and
+// refill, so lookahead (and with it the delay before a patch change is
+// heard) is as short as the machine allows.
+namespace pacemaker {
+	// Used until the period is known.
+	constexpr auto REFILL_LOW_WATER = std::chrono::milliseconds { 100 };
+	constexpr auto REFILL_HIGH_WATER = std::chrono::milliseconds { 200 };
+
+	constexpr auto REFILL_MIN_LOOKAHEAD = std::chrono::milliseconds { 2 };
+	constexpr auto REFILL_MAX_LOOKAHEAD = std::chrono::seconds { 1 };
+
+	// Process periods the low-water mark always covers. The callback only
+	// checks once per cycle so one of them is spent before it notices.
+	constexpr int64_t REFILL_PERIODS = 2;
+
+	// Measured wake up latency and generator cost are doubled for headroom.
+	constexpr int64_t REFILL_HEADROOM = 2;
+
+	// Measured peaks lose 1/64th per refill, so a one-off stall is forgotten
+	// after a few hundred refills.
+	constexpr int64_t REFILL_DECAY = 64;
+
+	// Longest the generator sleeps without being posted, so it still gets to
+	// run if the process callback stops.
+	constexpr auto REFILL_TIMEOUT = std::chrono::milliseconds { 100 };
+
+	struct Refill {
+		sem_t semaphore;
+
+		// Set while a post is outstanding so the semaphore never counts past
+		// one however many cycles ask for a refill.
+		std::atomic<bool> pending = false;
+
+		// Everything before this has been queued. Written by the generator.
+		std::atomic<int64_t> horizon = 0;
+
+		// Lookahead in `Unit` ticks, can be changed at any time.
+		std::atomic<int64_t> low_water = pacemaker::Unit { REFILL_LOW_WATER }.count();
+		std::atomic<int64_t> high_water = pacemaker::Unit { REFILL_HIGH_WATER }.count();
+
+		// Set by the generator while it waits for room in a full queue, so
+		// it's woken as soon as a cycle has drained some.
+		std::atomic<bool> waiting_for_room = false;
+
+		// Length of a process cycle, set whenever the buffer size or sample
+		// rate changes.
+		std::atomic<int64_t> period = 0;
+
+		// Start of the cycle that last asked for a refill or zero once the
+		// generator has picked it up.
+		std::atomic<int64_t> requested = 0;
+
+		// Decaying peaks of how late the generator woke up after being asked
+		// to and how long a refill took. Only written by the generator.
+		std::atomic<int64_t> latency_peak = 0;
+		std::atomic<int64_t> cost_peak = 0;
+
+		Refill() {
+			if (::sem_init(&semaphore, 0, 0) != 0) {
+				pacemaker::fatal_error("could not create semaphore");
+			}
+		}
+
+		~Refill() {
+			::sem_destroy(&semaphore);
+		}
+
+		Refill(const Refill&) = delete;
+		Refill& operator=(const Refill&) = delete;
+
+		// Wake the generator. `sem_post` doesn't block or allocate so this is
+		// safe to call from the process callback.
+		void post() {
+			if (not pending.exchange(true, std::memory_order_acq_rel)) {
+				::sem_post(&semaphore);
+			}
+		}
+
+		// Called by the process callback once per cycle with the time the
+		// current and next cycles start.
+		void check(pacemaker::Unit current, pacemaker::Unit next) {
+			int64_t remaining = horizon.load(std::memory_order_acquire) - next.count();
+
+			if (remaining < low_water.load(std::memory_order_relaxed) or
+				waiting_for_room.load(std::memory_order_relaxed)) {
+				if (requested.load(std::memory_order_relaxed) == 0) {
+					requested.store(current.count(), std::memory_order_relaxed);
+				}
+
+				post();
+			}
+		}
+
+		// Called from the buffer size and sample rate callbacks.
+		void set_period(pacemaker::Unit p) {
+			period.store(p.count(), std::memory_order_relaxed);
+			resize();
+		}
+
+		// Called by the generator when it wakes up.
+		void woken(pacemaker::Unit now) {
+			int64_t t = requested.exchange(0, std::memory_order_relaxed);
+
+			if (t != 0) {
+				decay(latency_peak, now.count() - t);
+			}
+		}
+
+		// Called by the generator after each refill with how long it took.
+		void refilled(std::chrono::nanoseconds cost) {
+			decay(cost_peak, std::chrono::duration_cast<pacemaker::Unit>(cost).count());
+			resize();
+		}
+
+		static void decay(std::atomic<int64_t>& peak, int64_t sample) {
+			int64_t current = peak.load(std::memory_order_relaxed);
+			peak.store(std::max(sample, current - current / REFILL_DECAY), std::memory_order_relaxed);
+		}
+
+		// Recompute the marks. The refill step is as long as the low-water
+		// mark so the generator wakes up about once per low-water mark.
+		void resize() {
+			int64_t p = period.load(std::memory_order_relaxed);
+
+			if (p == 0) {
+				return;
+			}
+
+			int64_t measured = latency_peak.load(std::memory_order_relaxed) + cost_peak.load(std::memory_order_relaxed);
+
+			int64_t low = std::clamp(REFILL_PERIODS * p + REFILL_HEADROOM * measured,
+				pacemaker::Unit { REFILL_MIN_LOOKAHEAD }.count(),
+				pacemaker::Unit { REFILL_MAX_LOOKAHEAD }.count());
+
+			low_water.store(low, std::memory_order_relaxed);
+			high_water.store(low * 2, std::memory_order_relaxed);
+		}
+
+		// Generator side. Block until posted or `timeout` has passed. The
+		// deadline is on the monotonic clock so wall clock jumps don't change
+		// how long this sleeps.
+		void wait(pacemaker::Unit timeout) {
+			timespec deadline;
+			::clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+			auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(timeout).count();
+			deadline.tv_sec += static_cast<time_t>(usecs / 1'000'000);
+			deadline.tv_nsec += static_cast<long>(usecs % 1'000'000 * 1'000);
+
+			if (deadline.tv_nsec >= 1'000'000'000) {
+				deadline.tv_sec += 1;
+				deadline.tv_nsec -= 1'000'000'000;
+			}
+
+			int result;
+
+			while ((result = ::sem_clockwait(&semaphore, CLOCK_MONOTONIC, &deadline)) != 0 and errno == EINTR) {}
+
+			// Only a consumed post clears `pending`. After a timeout a post
+			// may be on its way and clearing it would let the next one count
+			// the semaphore up to two.
+			if (result == 0) {
+				pending.store(false, std::memory_order_release);
+			}
+		}
+
+		// Where the generator should fill up to.
+		pacemaker::Unit target(pacemaker::Unit now) const {
+			return now + pacemaker::Unit { high_water.load(std::memory_order_relaxed) };
+		}
+
+		void set_horizon(pacemaker::Unit t) {
+			horizon.store(t.count(), std::memory_order_release);
+		}
+	};
+}  // namespace pacemaker
+
+#endif
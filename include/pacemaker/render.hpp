@@ -0,0 +1,152 @@
+#ifndef PACEMAKER_RENDER_HPP
+#define PACEMAKER_RENDER_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <string_view>
+
+#include <cstdint>
+
+#include <pacemaker/sequencer.hpp>
+#include <pacemaker/batch.hpp>
+#include <pacemaker/wheel.hpp>
+
+// Offline rendering of patches without a JACK server.
+namespace pacemaker {
+	// One tick per microsecond: a quarter note lasts `SMF_DIVISION` ticks and
+	// the tempo is set so that it also lasts `SMF_DIVISION` microseconds.
+	constexpr uint16_t SMF_DIVISION = 1'000;
+	constexpr uint32_t SMF_TEMPO = SMF_DIVISION;
+
+	// Largest delta time that fits in a variable length quantity.
+	constexpr uint32_t SMF_MAX_DELTA = 0x0FFF'FFFF;
+
+	// Length of each batch of events generated while rendering.
+	constexpr auto RENDER_WINDOW = std::chrono::seconds { 1 };
+
+	namespace detail {
+		inline void write_be(std::ostream& os, uint32_t x, size_t bytes) {
+			for (size_t i = bytes; i != 0; --i) {
+				os.put(static_cast<char>((x >> ((i - 1) * 8)) & 0xFF));
+			}
+		}
+
+		// Variable length quantity as used for SMF delta times.
+		inline size_t write_vlq(std::ostream& os, uint32_t x) {
+			std::array<char, 5> buf;
+			size_t n = 0;
+
+			buf[n++] = static_cast<char>(x & 0x7F);
+
+			while (x >>= 7) {
+				buf[n++] = static_cast<char>((x & 0x7F) | 0x80);
+			}
+
+			for (size_t i = n; i != 0; --i) {
+				os.put(buf[i - 1]);
+			}
+
+			return n;
+		}
+	}  // namespace detail
+
+	namespace detail {
+		// Call `fn(event)` for every event in [begin, end), generated one
+		// window at a time so memory use doesn't depend on the duration.
+		template <typename F>
+		inline void render_windows(pacemaker::Unit begin, pacemaker::Unit end, const pacemaker::Patch& p, F&& fn) {
+			pacemaker::CompiledPatch compiled { p };
+			pacemaker::WheelRenderer renderer;
+
+			for (pacemaker::Unit window = begin; window < end; window += RENDER_WINDOW) {
+				pacemaker::Unit window_end = std::min<pacemaker::Unit>(window + RENDER_WINDOW, end);
+
+				for (const auto& ev: renderer.render(window, window_end, compiled)) {
+					fn(ev);
+				}
+			}
+		}
+	}  // namespace detail
+
+	// Render [begin, end) of a patch to a format 0 Standard MIDI File.
+	// Events are generated in windows so memory use doesn't depend on the
+	// duration. The stream must be seekable because the track
+	// length is only known at the end. Returns the number of events written.
+	inline size_t write_smf(std::ostream& os, pacemaker::Unit begin, pacemaker::Unit end, const pacemaker::Patch& p) {
+		using namespace std::string_view_literals;
+
+		// Header chunk.
+		os << "MThd"sv;
+		detail::write_be(os, 6, 4);
+		detail::write_be(os, 0, 2);  // Format 0.
+		detail::write_be(os, 1, 2);  // Single track.
+		detail::write_be(os, SMF_DIVISION, 2);
+
+		// Track chunk, the length is filled in once we're done.
+		os << "MTrk"sv;
+		auto length_pos = os.tellp();
+		detail::write_be(os, 0, 4);
+
+		size_t length = 0;
+
+		// Tempo meta event.
+		length += detail::write_vlq(os, 0);
+		os << "\xFF\x51\x03"sv;
+		detail::write_be(os, SMF_TEMPO, 3);
+		length += 6;
+
+		pacemaker::Unit previous = begin;
+		size_t count = 0;
+
+		detail::render_windows(begin, end, p, [&](const pacemaker::Event& ev) {
+			auto delta = (ev.timestamp - previous).count();
+			previous = ev.timestamp;
+
+			// Bridge gaps too long for a single delta time (~4.5 minutes) with
+			// empty text meta events.
+			for (; delta > SMF_MAX_DELTA; delta -= SMF_MAX_DELTA) {
+				length += detail::write_vlq(os, SMF_MAX_DELTA);
+				os << "\xFF\x01\x00"sv;
+				length += 3;
+			}
+
+			// Program change and channel pressure only have one data byte.
+			size_t size = pacemaker::midi_size(ev.midi[0]);
+
+			length += detail::write_vlq(os, static_cast<uint32_t>(delta));
+			os.write(reinterpret_cast<const char*>(ev.midi.data()), static_cast<std::streamsize>(size));
+			length += size;
+
+			++count;
+		});
+
+		// End of track meta event.
+		length += detail::write_vlq(os, 0);
+		os << "\xFF\x2F\x00"sv;
+		length += 3;
+
+		auto end_pos = os.tellp();
+		os.seekp(length_pos);
+		detail::write_be(os, static_cast<uint32_t>(length), 4);
+		os.seekp(end_pos);
+
+		return count;
+	}
+
+	// Render [begin, end) of a patch as raw `Event` records in host byte order.
+	// Returns the number of events written.
+	inline size_t write_dump(std::ostream& os, pacemaker::Unit begin, pacemaker::Unit end, const pacemaker::Patch& p) {
+		size_t count = 0;
+
+		detail::render_windows(begin, end, p, [&](const pacemaker::Event& ev) {
+			os.write(reinterpret_cast<const char*>(&ev), sizeof(ev));
+			++count;
+		});
+
+		return count;
+	}
+}  // namespace pacemaker
+
+#endif
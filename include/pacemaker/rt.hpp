@@ -0,0 +1,108 @@
+#ifndef PACEMAKER_RT_HPP
+#define PACEMAKER_RT_HPP
+
+#include <algorithm>
+#include <array>
+#include <span>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+}
+
+#include <pacemaker/util.hpp>
+
+// Hardening of the threads on the real-time path so page faults and
+// migrations can't cause spikes: locking memory, touching everything the
+// threads will use before they need it and pinning them to cores with a
+// real-time priority.
+namespace pacemaker {
+	// Stack prefaulted in each thread that takes part in the real-time path.
+	constexpr size_t RT_STACK_PREFAULT = 256 * 1'024;
+
+	// Lock everything mapped now and later into memory. Usually needs a raised
+	// `RLIMIT_MEMLOCK` or `CAP_IPC_LOCK`.
+	inline bool lock_memory() {
+		if (::mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+			pacemaker::warning("could not lock memory: ", std::strerror(errno));
+			return false;
+		}
+
+		return true;
+	}
+
+	// Make sure every page of [p, p + size) is mapped writable. Without
+	// kernel support every page is written to, which is only safe while no
+	// other thread uses the memory.
+	inline void prefault(void* p, size_t size) {
+		if (size == 0) {
+			return;
+		}
+
+		auto page = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+		auto first = reinterpret_cast<uintptr_t>(p) & ~(page - 1);
+		auto last = reinterpret_cast<uintptr_t>(p) + size;
+
+#ifdef MADV_POPULATE_WRITE
+		if (::madvise(reinterpret_cast<void*>(first), last - first, MADV_POPULATE_WRITE) == 0) {
+			return;
+		}
+#endif
+
+		auto* bytes = static_cast<volatile char*>(p);
+
+		for (uintptr_t addr = reinterpret_cast<uintptr_t>(p); addr < last; addr = (addr & ~(page - 1)) + page) {
+			auto* c = bytes + (addr - reinterpret_cast<uintptr_t>(p));
+			*c = *c;
+		}
+	}
+
+	// Grow the calling thread's stack to `RT_STACK_PREFAULT` now rather than
+	// a page fault at a time.
+	[[gnu::noinline]] inline void prefault_stack() {
+		std::array<volatile char, RT_STACK_PREFAULT> stack;
+
+		for (size_t i = 0; i < stack.size(); i += 1'024) {
+			stack[i] = 0;
+		}
+	}
+
+	// Restrict the calling thread to `cpus`.
+	inline bool pin_thread(std::span<const int> cpus) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		for (int cpu: cpus) {
+			CPU_SET(cpu, &set);
+		}
+
+		if (int error = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set)) {
+			pacemaker::warning("could not pin thread: ", std::strerror(error));
+			return false;
+		}
+
+		return true;
+	}
+
+	// Run the calling thread under `SCHED_FIFO` at `priority`.
+	inline bool set_fifo_priority(int priority) {
+		sched_param param {};
+		param.sched_priority = priority;
+
+		if (int error = ::pthread_setschedparam(::pthread_self(), SCHED_FIFO, &param)) {
+			pacemaker::warning("could not set real-time priority: ", std::strerror(error));
+			return false;
+		}
+
+		return true;
+	}
+}  // namespace pacemaker
+
+#endif
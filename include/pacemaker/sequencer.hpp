@@ -2,16 +2,19 @@
 #define PACEMAKER_SEQUENCER_HPP
 
 #include <cstdint>
+#include <cstddef>
+#include <atomic>
 #include <vector>
 #include <array>
 #include <chrono>
 #include <algorithm>
+#include <iterator>
+#include <memory_resource>
+#include <span>
 
-#include <cmath>
+#include <pacemaker/timing.hpp>
 
 namespace pacemaker {
-	using Unit = std::chrono::microseconds;
-
 	using MidiPrimitive = uint8_t;
 	using MidiStatus = MidiPrimitive;
 	using MidiFunction = MidiPrimitive;
@@ -20,6 +23,9 @@ namespace pacemaker {
 	using MidiVelocity = MidiPrimitive;
 	using MidiData = MidiPrimitive;
 
+	// Index of an output port in `JackClient::ports`.
+	using PortIndex = uint8_t;
+
 	struct Status {
 		MidiChannel channel;
 		MidiFunction function;
@@ -35,88 +41,351 @@ namespace pacemaker {
 
 		pacemaker::Notes notes;
 
+		// Output port the channel's events are sent to.
+		PortIndex port;
+
 		Channel() = default;
 
-		Channel(Status status_, pacemaker::Unit frequency_, pacemaker::Unit offset_, pacemaker::Notes notes_):
-				status(status_), frequency(frequency_), offset(offset_), notes(notes_) {}
+		constexpr Channel(Status status_,
+			pacemaker::Unit frequency_,
+			pacemaker::Unit offset_,
+			pacemaker::Notes notes_,
+			PortIndex port_ = 0):
+				status(status_), frequency(frequency_), offset(offset_), notes(notes_), port(port_) {}
 	};
 
 	using Patch = std::vector<pacemaker::Channel>;
 
 	using Midi = std::array<MidiPrimitive, 3>;
 
+	// Bytes used by a channel message, program change and channel pressure
+	// only have one data byte.
+	constexpr size_t midi_size(MidiStatus status) {
+		MidiFunction function = status & 0xF0;
+		return (function == 0xC0 or function == 0xD0) ? 2 : 3;
+	}
+
 	struct Event {
 		pacemaker::Unit timestamp;
 		pacemaker::Midi midi;
 
+		// Fits in what would otherwise be padding.
+		PortIndex port;
+
 		Event() = default;
 
-		Event(pacemaker::Unit timestamp_, pacemaker::Midi midi_): timestamp(timestamp_), midi(midi_) {}
+		constexpr Event(pacemaker::Unit timestamp_, pacemaker::Midi midi_, PortIndex port_ = 0):
+				timestamp(timestamp_), midi(midi_), port(port_) {}
 
 		auto operator<=>(const Event&) const = default;
 	};
 
 	using Timeline = std::vector<pacemaker::Event>;
 
+	// Variants allocating from a `std::pmr::memory_resource`, usually a
+	// `WindowArena`, so generating events doesn't go through the global
+	// allocator.
+	namespace pmr {
+		using Notes = std::pmr::vector<MidiNote>;
+
+		// Allocator aware so a `pmr::Patch` hands its resource down to the
+		// notes of every channel.
+		struct Channel {
+			using allocator_type = std::pmr::polymorphic_allocator<>;
+
+			Status status;
+
+			pacemaker::Unit frequency;
+			pacemaker::Unit offset;
+
+			pacemaker::pmr::Notes notes;
+
+			PortIndex port;
+
+			explicit Channel(allocator_type alloc = {}): status {}, frequency {}, offset {}, notes(alloc), port(0) {}
+
+			Channel(Status status_,
+				pacemaker::Unit frequency_,
+				pacemaker::Unit offset_,
+				std::span<const MidiNote> notes_,
+				PortIndex port_ = 0,
+				allocator_type alloc = {}):
+					status(status_),
+					frequency(frequency_),
+					offset(offset_),
+					notes(notes_.begin(), notes_.end(), alloc),
+					port(port_) {}
+
+			Channel(const pacemaker::Channel& ch, allocator_type alloc = {}):
+					Channel(ch.status, ch.frequency, ch.offset, ch.notes, ch.port, alloc) {}
+
+			Channel(const Channel& other, allocator_type alloc = {}):
+					Channel(other.status, other.frequency, other.offset, other.notes, other.port, alloc) {}
+
+			Channel(Channel&& other, allocator_type alloc):
+					status(other.status),
+					frequency(other.frequency),
+					offset(other.offset),
+					notes(std::move(other.notes), alloc),
+					port(other.port) {}
+
+			Channel(Channel&&) = default;
+
+			Channel& operator=(const Channel&) = default;
+			Channel& operator=(Channel&&) = default;
+		};
+
+		using Patch = std::pmr::vector<pacemaker::pmr::Channel>;
+
+		using Timeline = std::pmr::vector<pacemaker::Event>;
+	}  // namespace pmr
+
 	namespace detail {
-		using namespace std::literals;
+		// Last `CompiledPatch::serial` handed out.
+		inline std::atomic<uint64_t> patch_serial { 0 };
+	}  // namespace detail
 
-		Unit event_at(Unit timestamp, Unit frequency, Unit offset = 0s) {
-			timestamp += offset;
+	// Flattened form of a `Patch` used for generating events. Each field is
+	// stored in its own array indexed by channel and every channel's notes
+	// live in a single shared pool, so walking thousands of channels touches
+	// only a few contiguous arrays instead of a heap allocation per channel.
+	// Channels without notes are dropped.
+	struct CompiledPatch {
+		std::vector<pacemaker::Unit> period;
+		std::vector<pacemaker::Unit> phase;
+
+		// `channel | function`, ready to be sent.
+		std::vector<MidiStatus> status;
+
+		// Range of each channel's notes within `notes`.
+		std::vector<uint32_t> note_offset;
+		std::vector<uint32_t> note_count;
+
+		std::vector<PortIndex> port;
+
+		std::vector<MidiNote> notes;
+
+		// Different for every compilation. Renderers keeping state between
+		// windows check it, a new patch may well have the old one's address.
+		uint64_t serial = 0;
+
+		CompiledPatch() = default;
+
+		explicit CompiledPatch(const pacemaker::Patch& p) {
+			compile(p);
+		}
+
+		explicit CompiledPatch(const pacemaker::pmr::Patch& p) {
+			compile(p);
+		}
+
+		size_t size() const {
+			return period.size();
+		}
+
+		template <typename P>
+		void compile(const P& p) {
+			size_t total = 0;
+
+			for (auto& ch: p) {
+				total += ch.notes.size();
+			}
+
+			serial = detail::patch_serial.fetch_add(1, std::memory_order_relaxed) + 1;
+
+			period.reserve(p.size());
+			phase.reserve(p.size());
+			status.reserve(p.size());
+			note_offset.reserve(p.size());
+			note_count.reserve(p.size());
+			port.reserve(p.size());
+			notes.reserve(total);
+
+			for (auto& [st, frequency, offset, ns, out]: p) {
+				if (ns.empty()) {
+					continue;
+				}
+
+				period.push_back(frequency);
+				phase.push_back(offset);
+				status.push_back(static_cast<MidiStatus>(st.channel | st.function));
+				note_offset.push_back(static_cast<uint32_t>(notes.size()));
+				note_count.push_back(static_cast<uint32_t>(ns.size()));
+				port.push_back(out);
+
+				notes.insert(notes.end(), ns.begin(), ns.end());
+			}
+		}
+	};
+
+	// A channel's events happen at `offset + frequency * n` for every integer
+	// `n`. These work in either time domain (`Unit` or `Frame`) using only
+	// integer arithmetic.
+	namespace detail {
+		// Index `n` of the first event at or after `timestamp`.
+		template <typename T>
+		constexpr int64_t event_index(T timestamp, T frequency, T offset = T {}) {
+			return detail::ceil_div(detail::ticks(timestamp - offset), detail::ticks(frequency));
+		}
 
-			return std::chrono::duration_cast<Unit>(frequency *
-				std::ceil(std::chrono::duration<double>(timestamp).count() /
-					std::chrono::duration<double>(frequency).count()));
+		// Time of the first event at or after `timestamp`.
+		template <typename T>
+		constexpr T event_at(T timestamp, T frequency, T offset = T {}) {
+			return offset + frequency * detail::event_index(timestamp, frequency, offset);
 		}
 
-		size_t events_between(Unit begin, Unit end, Unit frequency, Unit offset = 0s) {
-			begin += offset;
-			end += offset;
+		// Number of events in [begin, end).
+		template <typename T>
+		constexpr size_t events_between(T begin, T end, T frequency, T offset = T {}) {
+			if (end <= begin) {
+				return 0;
+			}
 
-			return (end - begin) / frequency;
+			return detail::event_index(end, frequency, offset) - detail::event_index(begin, frequency, offset);
 		}
 
-		size_t events_until(Unit timestamp, Unit frequency, Unit offset = 0s) {
+		// Number of events in [offset, timestamp).
+		template <typename T>
+		constexpr size_t events_until(T timestamp, T frequency, T offset = T {}) {
 			return events_between(offset, timestamp, frequency, offset);
 		}
 	}  // namespace detail
 
-	pacemaker::Timeline timeline(pacemaker::Unit begin, pacemaker::Unit end, const pacemaker::Patch& p) {
-		using namespace std::literals;
+	namespace detail {
+		// Position of a single channel within a window of time.
+		struct Cursor {
+			pacemaker::Event event;
+			pacemaker::Unit first_event;
+
+			size_t channel;
+			size_t index;
+			size_t count;
+
+			// Index of the first event since `offset`, used to pick notes.
+			int64_t n_before;
+		};
+
+		// Order cursors so that the earliest event sits at the top of the heap.
+		struct CursorCompare {
+			bool operator()(const Cursor& lhs, const Cursor& rhs) const {
+				return lhs.event > rhs.event;
+			}
+		};
+	}  // namespace detail
 
-		pacemaker::Timeline tl;
+	// Lazily merges the events of every channel in a patch in timestamp order.
+	// Each channel is an arithmetic progression so we only need to keep track
+	// of the next event per channel in a min-heap, yielding O(log C) work per
+	// event without buffering the whole window.
+	struct TimelineGenerator {
+		const pacemaker::CompiledPatch* patch;
+		std::vector<detail::Cursor> heap;
 
-		for (auto it = p.begin(); it != p.end(); ++it) {
-			auto& [status, frequency, offset, notes] = *it;
+		size_t remaining;
 
-			// Find the extent of the events we need for this slice of time.
-			auto first_event = detail::event_at(begin, frequency, offset);
-			auto last_event = detail::event_at(end, frequency, offset);
+		struct iterator {
+			using value_type = pacemaker::Event;
+			using difference_type = std::ptrdiff_t;
 
-			// Generate all of the in-between events (exclusive).
-			size_t event_count = detail::events_between(first_event, last_event, frequency, offset);
-			size_t n_before = detail::events_until(first_event, frequency, offset);
+			TimelineGenerator* generator;
 
-			for (size_t i = 0; i != event_count; ++i) {
-				pacemaker::Unit timestamp = frequency * i + first_event + offset;
+			const pacemaker::Event& operator*() const {
+				return generator->heap.front().event;
+			}
 
-				// if (timestamp >= end or timestamp < begin) {
-				// 	PACEMAKER_LOG(LogLevel::ERR, timestamp, " >= ", end, " or ", timestamp, " < ", begin);
-				// }
+			const pacemaker::Event* operator->() const {
+				return &generator->heap.front().event;
+			}
 
-				pacemaker::MidiNote note = notes.at((i + n_before) % notes.size());
-				pacemaker::MidiVelocity velocity = 127;
+			iterator& operator++() {
+				generator->advance();
+				return *this;
+			}
 
-				MidiStatus midi_status = status.channel | status.function;
+			void operator++(int) {
+				++*this;
+			}
 
-				tl.emplace_back(timestamp, pacemaker::Midi { midi_status, note, velocity });
+			bool operator==(std::default_sentinel_t) const {
+				return generator->heap.empty();
 			}
+		};
+
+		TimelineGenerator(): patch(nullptr), remaining(0) {}
+
+		TimelineGenerator(pacemaker::Unit begin, pacemaker::Unit end, const pacemaker::CompiledPatch& p):
+				patch(&p), remaining(0) {
+			reset(begin, end);
 		}
 
-		std::sort(tl.begin(), tl.end());
+		// Start generating a new window. The heap storage is reused so
+		// consecutive windows over the same patch don't allocate.
+		void reset(pacemaker::Unit begin, pacemaker::Unit end) {
+			heap.clear();
+			remaining = 0;
 
-		return tl;
-	}
+			for (size_t ch = 0; ch != patch->size(); ++ch) {
+				auto frequency = patch->period[ch];
+				auto offset = patch->phase[ch];
+
+				// Find the extent of the events we need for this slice of time.
+				auto first_event = detail::event_at(begin, frequency, offset);
+
+				size_t event_count = detail::events_between(begin, end, frequency, offset);
+				int64_t n_before = detail::event_index(begin, frequency, offset);
+
+				if (event_count == 0) {
+					continue;
+				}
+
+				detail::Cursor cursor { {}, first_event, ch, 0, event_count, n_before };
+				cursor.event = event(cursor);
+
+				heap.emplace_back(cursor);
+				remaining += event_count;
+			}
+
+			std::make_heap(heap.begin(), heap.end(), detail::CursorCompare {});
+		}
+
+		// Compute the event a cursor currently points at.
+		pacemaker::Event event(const detail::Cursor& cursor) const {
+			size_t ch = cursor.channel;
+			auto index = static_cast<int64_t>(cursor.index);
+
+			pacemaker::Unit timestamp = cursor.first_event + patch->period[ch] * index;
+
+			auto n = detail::phase(cursor.n_before + index, patch->note_count[ch]);
+			pacemaker::MidiNote note = patch->notes[patch->note_offset[ch] + static_cast<size_t>(n)];
+			pacemaker::MidiVelocity velocity = 127;
+
+			return { timestamp, pacemaker::Midi { patch->status[ch], note, velocity }, patch->port[ch] };
+		}
+
+		// Move past the earliest event.
+		void advance() {
+			std::pop_heap(heap.begin(), heap.end(), detail::CursorCompare {});
+
+			auto& cursor = heap.back();
+			--remaining;
+
+			if (++cursor.index == cursor.count) {
+				heap.pop_back();
+				return;
+			}
+
+			cursor.event = event(cursor);
+			std::push_heap(heap.begin(), heap.end(), detail::CursorCompare {});
+		}
+
+		iterator begin() {
+			return { this };
+		}
+
+		std::default_sentinel_t end() const {
+			return {};
+		}
+	};
 }  // namespace pacemaker
 
 // std::ostream overloads
@@ -148,7 +417,8 @@ namespace pacemaker {
 	}
 
 	inline std::ostream& operator<<(std::ostream& os, const Channel& ch) {
-		return (os << "{status: " << ch.status << ", frequency: " << ch.frequency << ", notes: " << ch.notes << "}");
+		return (os << "{status: " << ch.status << ", frequency: " << ch.frequency << ", notes: " << ch.notes
+				   << ", port: " << (int)ch.port << "}");
 	}
 
 	inline std::ostream& operator<<(std::ostream& os, const Patch& p) {
@@ -160,12 +430,16 @@ namespace pacemaker {
 	}
 
 	inline std::ostream& operator<<(std::ostream& os, const Event& ev) {
-		return (os << "{timestamp: " << ev.timestamp << ", data: " << ev.midi << "}");
+		return (os << "{timestamp: " << ev.timestamp << ", data: " << ev.midi << ", port: " << (int)ev.port << "}");
 	}
 
 	inline std::ostream& operator<<(std::ostream& os, const Timeline& tl) {
 		return detail::serialise_container(os, tl);
 	}
+
+	inline std::ostream& operator<<(std::ostream& os, const pmr::Timeline& tl) {
+		return detail::serialise_container(os, tl);
+	}
 }  // namespace pacemaker
 
 #endif
\ No newline at end of file
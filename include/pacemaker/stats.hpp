@@ -0,0 +1,353 @@
+#ifndef PACEMAKER_STATS_HPP
+#define PACEMAKER_STATS_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <pacemaker/util.hpp>
+
+// Instrumentation of the real-time path. The process callback updates a
+// block of atomic counters with relaxed stores (it is the only writer for
+// almost all of them) and anyone else can take a snapshot at any time
+// without synchronising with it.
+namespace pacemaker {
+	// Callback durations are bucketed by powers of two microseconds:
+	// [0, 1), [1, 2), [2, 4), ... with the last bucket catching the rest.
+	constexpr size_t STATS_BUCKETS = 16;
+
+	constexpr auto STATS_INTERVAL = std::chrono::seconds { 1 };
+
+	// Plain copy of `CycleStats` at some point in time.
+	struct StatsSnapshot {
+		uint64_t cycles;
+		std::array<uint64_t, STATS_BUCKETS> duration_histogram;
+		uint64_t max_duration_usecs;
+
+		uint64_t events_emitted;
+		uint64_t last_emitted;
+		uint64_t max_emitted;
+
+		// Due in a cycle but didn't fit in the port buffer, so they were
+		// pushed back to the next cycle.
+		uint64_t events_deferred;
+		uint64_t last_deferred;
+
+		uint64_t queue_depth;
+		uint64_t max_queue_depth;
+
+		float cpu_load;
+
+		uint64_t xruns;
+		float max_xrun_delay_usecs;
+
+		// Events placed after their timestamp and by how much.
+		uint64_t late_events;
+		uint64_t max_lateness_usecs;
+
+		// Frame each event was written at against the frame its timestamp
+		// falls on, in frames. Dividing the sum of absolute errors by
+		// `events_emitted + events_looped` gives the mean.
+		uint64_t max_early_frames;
+		uint64_t max_late_frames;
+		uint64_t frame_error_sum;
+
+		// Input events recorded and lost because the capture queue was full.
+		uint64_t events_captured;
+		uint64_t capture_overflows;
+
+		// Input events forwarded to an output in the same cycle and those
+		// that didn't fit.
+		uint64_t events_thru;
+		uint64_t thru_dropped;
+
+		// Events played from a loop table and those that didn't fit or
+		// were for a port that doesn't exist.
+		uint64_t events_looped;
+		uint64_t loop_dropped;
+
+		// Events held back because their port was muted.
+		uint64_t events_muted;
+	};
+
+	struct CycleStats {
+		std::atomic<uint64_t> cycles {};
+		std::array<std::atomic<uint64_t>, STATS_BUCKETS> duration_histogram {};
+		std::atomic<uint64_t> max_duration_usecs {};
+
+		std::atomic<uint64_t> events_emitted {};
+		std::atomic<uint64_t> last_emitted {};
+		std::atomic<uint64_t> max_emitted {};
+
+		std::atomic<uint64_t> events_deferred {};
+		std::atomic<uint64_t> last_deferred {};
+
+		std::atomic<uint64_t> queue_depth {};
+		std::atomic<uint64_t> max_queue_depth {};
+
+		std::atomic<float> cpu_load {};
+
+		// Updated from JACK's notification thread.
+		std::atomic<uint64_t> xruns {};
+		std::atomic<float> max_xrun_delay_usecs {};
+
+		std::atomic<uint64_t> late_events {};
+		std::atomic<uint64_t> max_lateness_usecs {};
+
+		std::atomic<uint64_t> max_early_frames {};
+		std::atomic<uint64_t> max_late_frames {};
+		std::atomic<uint64_t> frame_error_sum {};
+
+		std::atomic<uint64_t> events_captured {};
+		std::atomic<uint64_t> capture_overflows {};
+
+		std::atomic<uint64_t> events_thru {};
+		std::atomic<uint64_t> thru_dropped {};
+
+		std::atomic<uint64_t> events_looped {};
+		std::atomic<uint64_t> loop_dropped {};
+
+		std::atomic<uint64_t> events_muted {};
+
+		// Counters of the cycle currently being processed, only touched by
+		// the process callback.
+		struct Cycle {
+			uint64_t emitted;
+			uint64_t deferred;
+			uint64_t late;
+			uint64_t max_lateness_usecs;
+			uint64_t max_early_frames;
+			uint64_t max_late_frames;
+			uint64_t frame_error_sum;
+			uint64_t queue_depth;
+			uint64_t captured;
+			uint64_t capture_overflows;
+			uint64_t thru;
+			uint64_t thru_dropped;
+			uint64_t looped;
+			uint64_t loop_dropped;
+			uint64_t muted;
+
+			// `error` is the written frame minus the scheduled one.
+			void frame_error(int64_t error) {
+				auto magnitude = static_cast<uint64_t>(error < 0 ? -error : error);
+
+				if (error < 0) {
+					max_early_frames = std::max(max_early_frames, magnitude);
+				}
+				else {
+					max_late_frames = std::max(max_late_frames, magnitude);
+				}
+
+				frame_error_sum += magnitude;
+			}
+		};
+
+		// Single writer increment, avoids a locked RMW on the RT thread.
+		static void bump(std::atomic<uint64_t>& x, uint64_t n = 1) {
+			x.store(x.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		// Single writer maximum.
+		template <typename T>
+		static void raise(std::atomic<T>& x, T value) {
+			if (value > x.load(std::memory_order_relaxed)) {
+				x.store(value, std::memory_order_relaxed);
+			}
+		}
+
+		// Called by the process callback once per cycle.
+		void record(const Cycle& cycle, std::chrono::nanoseconds duration, float load) {
+			auto usecs = static_cast<uint64_t>(duration.count() / 1'000);
+			size_t bucket = std::min<size_t>(std::bit_width(usecs), STATS_BUCKETS - 1);
+
+			bump(cycles);
+			bump(duration_histogram[bucket]);
+			raise(max_duration_usecs, usecs);
+
+			bump(events_emitted, cycle.emitted);
+			last_emitted.store(cycle.emitted, std::memory_order_relaxed);
+			raise(max_emitted, cycle.emitted);
+
+			bump(events_deferred, cycle.deferred);
+			last_deferred.store(cycle.deferred, std::memory_order_relaxed);
+
+			queue_depth.store(cycle.queue_depth, std::memory_order_relaxed);
+			raise(max_queue_depth, cycle.queue_depth);
+
+			cpu_load.store(load, std::memory_order_relaxed);
+
+			bump(late_events, cycle.late);
+			raise(max_lateness_usecs, cycle.max_lateness_usecs);
+
+			raise(max_early_frames, cycle.max_early_frames);
+			raise(max_late_frames, cycle.max_late_frames);
+			bump(frame_error_sum, cycle.frame_error_sum);
+
+			bump(events_captured, cycle.captured);
+			bump(capture_overflows, cycle.capture_overflows);
+
+			bump(events_thru, cycle.thru);
+			bump(thru_dropped, cycle.thru_dropped);
+
+			bump(events_looped, cycle.looped);
+			bump(loop_dropped, cycle.loop_dropped);
+
+			bump(events_muted, cycle.muted);
+		}
+
+		// Can be called from any thread.
+		void record_xrun(float delay_usecs) {
+			xruns.fetch_add(1, std::memory_order_relaxed);
+
+			float current = max_xrun_delay_usecs.load(std::memory_order_relaxed);
+			while (delay_usecs > current and
+				not max_xrun_delay_usecs.compare_exchange_weak(current, delay_usecs, std::memory_order_relaxed)) {}
+		}
+
+		StatsSnapshot snapshot() const {
+			StatsSnapshot s;
+
+			s.cycles = cycles.load(std::memory_order_relaxed);
+
+			for (size_t i = 0; i != STATS_BUCKETS; ++i) {
+				s.duration_histogram[i] = duration_histogram[i].load(std::memory_order_relaxed);
+			}
+
+			s.max_duration_usecs = max_duration_usecs.load(std::memory_order_relaxed);
+
+			s.events_emitted = events_emitted.load(std::memory_order_relaxed);
+			s.last_emitted = last_emitted.load(std::memory_order_relaxed);
+			s.max_emitted = max_emitted.load(std::memory_order_relaxed);
+
+			s.events_deferred = events_deferred.load(std::memory_order_relaxed);
+			s.last_deferred = last_deferred.load(std::memory_order_relaxed);
+
+			s.queue_depth = queue_depth.load(std::memory_order_relaxed);
+			s.max_queue_depth = max_queue_depth.load(std::memory_order_relaxed);
+
+			s.cpu_load = cpu_load.load(std::memory_order_relaxed);
+
+			s.xruns = xruns.load(std::memory_order_relaxed);
+			s.max_xrun_delay_usecs = max_xrun_delay_usecs.load(std::memory_order_relaxed);
+
+			s.late_events = late_events.load(std::memory_order_relaxed);
+			s.max_lateness_usecs = max_lateness_usecs.load(std::memory_order_relaxed);
+
+			s.max_early_frames = max_early_frames.load(std::memory_order_relaxed);
+			s.max_late_frames = max_late_frames.load(std::memory_order_relaxed);
+			s.frame_error_sum = frame_error_sum.load(std::memory_order_relaxed);
+
+			s.events_captured = events_captured.load(std::memory_order_relaxed);
+			s.capture_overflows = capture_overflows.load(std::memory_order_relaxed);
+
+			s.events_thru = events_thru.load(std::memory_order_relaxed);
+			s.thru_dropped = thru_dropped.load(std::memory_order_relaxed);
+
+			s.events_looped = events_looped.load(std::memory_order_relaxed);
+			s.loop_dropped = loop_dropped.load(std::memory_order_relaxed);
+
+			s.events_muted = events_muted.load(std::memory_order_relaxed);
+
+			return s;
+		}
+	};
+
+	inline std::ostream& operator<<(std::ostream& os, const StatsSnapshot& s) {
+		os << "{\n";
+		os << "  \"cycles\": " << s.cycles << ",\n";
+		os << "  \"duration_histogram_usecs\": [";
+
+		for (size_t i = 0; i != STATS_BUCKETS; ++i) {
+			os << (i == 0 ? "" : ", ") << s.duration_histogram[i];
+		}
+
+		os << "],\n";
+		os << "  \"max_duration_usecs\": " << s.max_duration_usecs << ",\n";
+		os << "  \"events_emitted\": " << s.events_emitted << ",\n";
+		os << "  \"last_emitted\": " << s.last_emitted << ",\n";
+		os << "  \"max_emitted\": " << s.max_emitted << ",\n";
+		os << "  \"events_deferred\": " << s.events_deferred << ",\n";
+		os << "  \"last_deferred\": " << s.last_deferred << ",\n";
+		os << "  \"queue_depth\": " << s.queue_depth << ",\n";
+		os << "  \"max_queue_depth\": " << s.max_queue_depth << ",\n";
+		os << "  \"cpu_load\": " << s.cpu_load << ",\n";
+		os << "  \"xruns\": " << s.xruns << ",\n";
+		os << "  \"max_xrun_delay_usecs\": " << s.max_xrun_delay_usecs << ",\n";
+		os << "  \"late_events\": " << s.late_events << ",\n";
+		os << "  \"max_lateness_usecs\": " << s.max_lateness_usecs << ",\n";
+		os << "  \"max_early_frames\": " << s.max_early_frames << ",\n";
+		os << "  \"max_late_frames\": " << s.max_late_frames << ",\n";
+		os << "  \"frame_error_sum\": " << s.frame_error_sum << ",\n";
+		os << "  \"events_captured\": " << s.events_captured << ",\n";
+		os << "  \"capture_overflows\": " << s.capture_overflows << ",\n";
+		os << "  \"events_thru\": " << s.events_thru << ",\n";
+		os << "  \"thru_dropped\": " << s.thru_dropped << ",\n";
+		os << "  \"events_looped\": " << s.events_looped << ",\n";
+		os << "  \"loop_dropped\": " << s.loop_dropped << ",\n";
+		os << "  \"events_muted\": " << s.events_muted << "\n";
+		os << "}\n";
+
+		return os;
+	}
+
+	// Periodically writes a JSON snapshot of `stats` to `path`. The file is
+	// replaced with a rename so readers never see a partial write.
+	struct StatsFile {
+		// Only used to wake the thread up early when stopping.
+		std::mutex mutex;
+		std::condition_variable_any wake;
+
+		std::jthread thread;
+
+		StatsFile(const CycleStats& stats, std::string path, std::chrono::milliseconds interval = STATS_INTERVAL):
+				thread([this, &stats, path = std::move(path), interval](std::stop_token stop) {
+					std::unique_lock lock { mutex };
+
+					while (not stop.stop_requested()) {
+						write(stats, path);
+						wake.wait_for(lock, stop, interval, [] { return false; });
+					}
+
+					write(stats, path);
+				}) {}
+
+		static void write(const CycleStats& stats, const std::string& path) {
+			std::string tmp = path + ".tmp";
+
+			{
+				std::ofstream os { tmp };
+
+				if (not os) {
+					pacemaker::warning("could not write stats to `", tmp, "`");
+					return;
+				}
+
+				os << stats.snapshot();
+			}
+
+			std::error_code ec;
+			std::filesystem::rename(tmp, path, ec);
+
+			if (ec) {
+				pacemaker::warning("could not rename `", tmp, "`: ", ec.message());
+			}
+		}
+	};
+}  // namespace pacemaker
+
+#endif
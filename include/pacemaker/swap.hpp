@@ -0,0 +1,81 @@
+#ifndef PACEMAKER_SWAP_HPP
+#define PACEMAKER_SWAP_HPP
+
+#include <atomic>
+#include <memory>
+
+#include <pacemaker/queue.hpp>
+
+namespace pacemaker {
+	// Capacity of the queue handing retired versions back to the publisher.
+	constexpr auto SWAP_RETIRED_SIZE = 16;
+
+	// Publishes immutable versions of `T` from a control thread to a single
+	// consumer without locking or blocking either side.
+	//
+	// Ownership moves through an atomic pointer: the publisher exchanges in a
+	// new version and the consumer exchanges it out at a boundary of its
+	// choosing (so it never sees a version change mid-cycle). Versions the
+	// consumer is done with are handed back through a queue and deleted by
+	// the publisher so that the consumer never frees memory.
+	template <typename T>
+	struct HotSwap {
+		// Only touched by the consumer.
+		T* current;
+
+		std::atomic<T*> pending;
+		pacemaker::SpscQueue<T*, SWAP_RETIRED_SIZE> retired;
+
+		HotSwap(): current(nullptr), pending(nullptr) {}
+
+		HotSwap(const HotSwap&) = delete;
+		HotSwap& operator=(const HotSwap&) = delete;
+
+		// Destroy from the publisher once the consumer has stopped.
+		~HotSwap() {
+			collect();
+			delete pending.load(std::memory_order_acquire);
+			delete current;
+		}
+
+		// Publisher side.
+		void publish(std::unique_ptr<T> next) {
+			collect();
+
+			// If the consumer hasn't picked up the previous version yet it never
+			// will, so we can free it immediately.
+			delete pending.exchange(next.release(), std::memory_order_acq_rel);
+		}
+
+		// Reclaim versions that the consumer has finished with.
+		void collect() {
+			T* old = nullptr;
+
+			while (retired.pop(old)) {
+				delete old;
+			}
+		}
+
+		// Consumer side.
+		// Returns the latest version, switching over if a new one has been
+		// published. Never allocates or frees.
+		T* acquire() {
+			// Defer the switch if there is nowhere to put the old version.
+			if (current and retired.size() == retired.capacity()) {
+				return current;
+			}
+
+			if (T* next = pending.exchange(nullptr, std::memory_order_acq_rel)) {
+				if (current) {
+					retired.push(current);
+				}
+
+				current = next;
+			}
+
+			return current;
+		}
+	};
+}  // namespace pacemaker
+
+#endif
@@ -0,0 +1,293 @@
+#ifndef PACEMAKER_THRU_HPP
+#define PACEMAKER_THRU_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include <jack/types.h>
+}
+
+#include <pacemaker/const.hpp>
+#include <pacemaker/timing.hpp>
+#include <pacemaker/swap.hpp>
+#include <pacemaker/sequencer.hpp>
+
+// MIDI thru. Events read from the input ports are transformed and written to
+// the output ports in the same cycle, merged with the sequencer's events, so
+// live material goes out without an extra period of latency.
+namespace pacemaker {
+	// Capacity of the per-cycle buffer of transformed events. Anything past
+	// this is dropped.
+	constexpr size_t THRU_EVENTS = 1'024;
+
+	// One note of a pattern a note on triggers, `delay` after it and
+	// `interval` semitones away from it.
+	struct ThruStep {
+		pacemaker::Unit delay {};
+		pacemaker::Unit length {};
+		int interval = 0;
+	};
+
+	// Every rule an incoming event matches produces one outgoing event, so
+	// rules can split the keyboard or layer the same notes on several ports.
+	struct ThruRule {
+		// Bit `i` selects `JackClient::inputs[i]`.
+		uint64_t inputs = ~uint64_t { 0 };
+
+		// Bit `i` selects MIDI channel `i`.
+		uint16_t channels = 0xFFFF;
+
+		// Inclusive range of incoming notes.
+		MidiNote low = 0;
+		MidiNote high = 127;
+
+		// Semitones, notes shifted out of range are dropped.
+		int transpose = 0;
+
+		// Note on velocities are scaled by this but never reach zero.
+		float velocity = 1.0f;
+
+		// Output MIDI channel, or negative to keep the incoming one.
+		int channel = -1;
+
+		// Only forward note on/off and polyphonic aftertouch.
+		bool notes_only = false;
+
+		// Play these notes in place of every note on. The note off and
+		// aftertouch of the trigger are dropped, each step ends by itself.
+		std::vector<ThruStep> pattern;
+
+		PortIndex port = 0;
+	};
+
+	using Thru = std::vector<pacemaker::ThruRule>;
+
+	// A rule flattened into lookup tables so applying it is a handful of
+	// loads and no arithmetic.
+	struct CompiledThruRule {
+		uint64_t inputs;
+		uint16_t channels;
+
+		// Outgoing note per incoming note or negative if it's filtered out.
+		std::array<int16_t, 128> note;
+		std::array<MidiVelocity, 128> velocity;
+
+		int channel;
+		bool notes_only;
+
+		std::vector<ThruStep> pattern;
+
+		PortIndex port;
+
+		explicit CompiledThruRule(const ThruRule& rule):
+				inputs(rule.inputs),
+				channels(rule.channels),
+				channel(rule.channel),
+				notes_only(rule.notes_only),
+				pattern(rule.pattern),
+				port(rule.port) {
+			for (int i = 0; i != 128; ++i) {
+				int out = i + rule.transpose;
+				bool is_mapped = i >= rule.low and i <= rule.high and out >= 0 and out <= 127;
+
+				note[i] = static_cast<int16_t>(is_mapped ? out : -1);
+
+				// Zero is a note off and has to stay that way.
+				long scaled = std::lround(static_cast<float>(i) * rule.velocity);
+				velocity[i] = static_cast<MidiVelocity>(i == 0 ? 0 : std::clamp(scaled, 1L, 127L));
+			}
+		}
+	};
+
+	struct CompiledThru {
+		std::vector<CompiledThruRule> rules;
+
+		CompiledThru() = default;
+
+		explicit CompiledThru(const pacemaker::Thru& thru) {
+			rules.reserve(thru.size());
+
+			for (auto& rule: thru) {
+				rules.emplace_back(rule);
+			}
+		}
+
+		// Call `out(midi, port, delay)` for every event the rules `midi`
+		// arriving on input port `input` matches produce, `delay` is zero
+		// unless it's part of a pattern. System messages are never forwarded.
+		template <typename F>
+		void apply(size_t input, const pacemaker::Midi& midi, F&& out) const {
+			MidiStatus function = midi[0] & 0xF0;
+			MidiChannel channel = midi[0] & 0x0F;
+
+			if (function < MIDI_NOTE_OFF or function == 0xF0) {
+				return;
+			}
+
+			bool is_note = function == MIDI_NOTE_OFF or function == MIDI_NOTE_ON or function == MIDI_POLY_AFTERTOUCH;
+
+			for (auto& rule: rules) {
+				if (not(rule.inputs >> input & 1) or not(rule.channels >> channel & 1)) {
+					continue;
+				}
+
+				pacemaker::Midi result = midi;
+
+				if (rule.channel >= 0) {
+					result[0] = static_cast<MidiStatus>(function | rule.channel);
+				}
+
+				if (is_note) {
+					int16_t note = rule.note[midi[1] & 0x7F];
+
+					if (note < 0) {
+						continue;
+					}
+
+					result[1] = static_cast<MidiNote>(note);
+
+					if (function == MIDI_NOTE_ON) {
+						result[2] = rule.velocity[midi[2] & 0x7F];
+					}
+
+					if (not rule.pattern.empty()) {
+						// A note on with zero velocity is a note off.
+						if (function == MIDI_NOTE_ON and result[2] != 0) {
+							trigger(rule, result, out);
+						}
+
+						continue;
+					}
+				}
+				else if (rule.notes_only) {
+					continue;
+				}
+
+				out(result, rule.port, pacemaker::Unit {});
+			}
+		}
+
+		// Steps that would leave the note range are skipped.
+		template <typename F>
+		static void trigger(const CompiledThruRule& rule, const pacemaker::Midi& on, F&& out) {
+			auto off = static_cast<MidiStatus>(MIDI_NOTE_OFF | (on[0] & 0x0F));
+
+			for (auto& step: rule.pattern) {
+				int note = on[1] + step.interval;
+
+				if (note < 0 or note > 127) {
+					continue;
+				}
+
+				auto key = static_cast<MidiNote>(note);
+
+				out(pacemaker::Midi { on[0], key, on[2] }, rule.port, step.delay);
+				out(pacemaker::Midi { off, key, 0 }, rule.port, step.delay + step.length);
+			}
+		}
+	};
+
+	// An event on its way from an input to an output port.
+	struct ThruEvent {
+		jack_nframes_t offset;
+		pacemaker::Midi midi;
+		PortIndex port;
+
+		// Arrival order, keeps events at the same offset in sequence.
+		uint16_t sequence;
+	};
+
+	// A pattern event waiting for the cycle it's due in.
+	struct ThruLater {
+		jack_nframes_t frame;
+		pacemaker::Midi midi;
+		PortIndex port;
+	};
+
+	// State of the thru stage shared between the process callback and
+	// whoever publishes rules.
+	struct ThruPath {
+		pacemaker::HotSwap<const pacemaker::CompiledThru> rules;
+
+		// Transformed events of the current cycle, sorted by port and then
+		// offset. Only touched by the process callback.
+		std::array<ThruEvent, THRU_EVENTS> events;
+		size_t count = 0;
+
+		// Pattern events due in a later cycle, in the order they were
+		// triggered. Also only touched by the process callback.
+		std::array<ThruLater, THRU_EVENTS> later;
+		size_t later_count = 0;
+
+		// Replace the rules, picked up at the start of the next cycle.
+		void publish(const pacemaker::Thru& thru) {
+			rules.publish(std::make_unique<const pacemaker::CompiledThru>(thru));
+		}
+
+		// Queue a transformed event, returns `false` if the buffer is full.
+		bool push(jack_nframes_t offset, const pacemaker::Midi& midi, PortIndex port) {
+			if (count == events.size()) {
+				return false;
+			}
+
+			events[count] = { offset, midi, port, static_cast<uint16_t>(count) };
+			++count;
+
+			return true;
+		}
+
+		// Queue an event due at the absolute `frame`, returns `false` if the
+		// buffer is full.
+		bool defer(jack_nframes_t frame, const pacemaker::Midi& midi, PortIndex port) {
+			if (later_count == later.size()) {
+				return false;
+			}
+
+			later[later_count] = { frame, midi, port };
+			++later_count;
+
+			return true;
+		}
+
+		// Move deferred events due in the cycle of `nframes` starting at
+		// `current` over to this cycle's events. Returns how many of them
+		// didn't fit.
+		size_t flush(jack_nframes_t current, jack_nframes_t nframes) {
+			size_t kept = 0;
+			size_t dropped = 0;
+
+			for (size_t i = 0; i != later_count; ++i) {
+				// Frame counters wrap around.
+				auto delta = static_cast<int32_t>(later[i].frame - current);
+
+				if (delta >= static_cast<int64_t>(nframes)) {
+					later[kept++] = later[i];
+				}
+				else if (not push(static_cast<jack_nframes_t>(std::max(delta, 0)), later[i].midi, later[i].port)) {
+					++dropped;
+				}
+			}
+
+			later_count = kept;
+			return dropped;
+		}
+
+		// Order the cycle's events for writing. Sorting by arrival as well
+		// makes this stable without `std::stable_sort`, which may allocate.
+		void sort() {
+			std::sort(events.begin(), events.begin() + static_cast<std::ptrdiff_t>(count), [](auto& lhs, auto& rhs) {
+				return std::tie(lhs.port, lhs.offset, lhs.sequence) < std::tie(rhs.port, rhs.offset, rhs.sequence);
+			});
+		}
+	};
+}  // namespace pacemaker
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef PACEMAKER_TIMING_HPP
+#define PACEMAKER_TIMING_HPP
+
+#include <chrono>
+#include <type_traits>
+
+#include <cstdint>
+
+namespace pacemaker {
+	using Unit = std::chrono::microseconds;
+
+	// Absolute position in sample frames.
+	using Frame = int64_t;
+
+	constexpr int64_t USECS_PER_SECOND = 1'000'000;
+
+	namespace detail {
+		// Integer division rounding towards negative infinity.
+		constexpr int64_t floor_div(int64_t num, int64_t den) {
+			int64_t q = num / den;
+			return q - ((num % den != 0) and ((num < 0) != (den < 0)));
+		}
+
+		// Integer division rounding towards positive infinity.
+		constexpr int64_t ceil_div(int64_t num, int64_t den) {
+			int64_t q = num / den;
+			return q + ((num % den != 0) and ((num < 0) == (den < 0)));
+		}
+
+		// Position of `x` within a period, always in the range [0, period).
+		constexpr int64_t phase(int64_t x, int64_t period) {
+			return x - floor_div(x, period) * period;
+		}
+
+		// Exact `floor(x * num / den)` without overflowing the intermediate
+		// product as long as `phase(x, den) * num` fits in 64 bits.
+		constexpr int64_t scale(int64_t x, int64_t num, int64_t den) {
+			return floor_div(x, den) * num + phase(x, den) * num / den;
+		}
+
+		// Lets the timing functions accept both `Unit` and `Frame`.
+		template <typename T>
+		constexpr int64_t ticks(T x) {
+			if constexpr (std::is_integral_v<T>) {
+				return x;
+			}
+			else {
+				return x.count();
+			}
+		}
+	}  // namespace detail
+
+	// Conversions between microseconds and sample frames. Frames are rounded
+	// down so a converted timestamp never lands after the time it names.
+	constexpr Frame to_frames(Unit timestamp, uint32_t sample_rate) {
+		return detail::scale(timestamp.count(), sample_rate, USECS_PER_SECOND);
+	}
+
+	constexpr Unit to_unit(Frame frames, uint32_t sample_rate) {
+		return Unit { detail::scale(frames, USECS_PER_SECOND, sample_rate) };
+	}
+}  // namespace pacemaker
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef PACEMAKER_TRACE_HPP
+#define PACEMAKER_TRACE_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <pacemaker/util.hpp>
+
+// Opt-in tracing of the scheduler and the real-time path. Build with
+// `PACEMAKER_TRACING` defined to record spans, otherwise the macros below
+// expand to nothing.
+//
+// Every thread claims one of a fixed number of preallocated buffers the
+// first time it records something, so recording never allocates or locks.
+// Buffers are rings keeping the most recent events, so a dump always covers
+// what just happened. Buffers are dumped as Chrome trace JSON which can be
+// loaded into `chrome://tracing` or Perfetto.
+namespace pacemaker {
+#ifdef PACEMAKER_TRACING
+	constexpr bool TRACING = true;
+#else
+	constexpr bool TRACING = false;
+#endif
+
+	constexpr size_t TRACE_MAX_THREADS = 16;
+	constexpr size_t TRACE_BUFFER_SIZE = 1 << 16;
+
+	namespace detail {
+		// Fields are relaxed atomics because a dump can read a slot while its
+		// thread overwrites it. Such slots are detected and skipped.
+		struct TraceEvent {
+			std::atomic<const char*> name;
+			std::atomic<int64_t> nanoseconds;
+
+			// 'B'egin, 'E'nd or 'i'nstant as in the trace event format.
+			std::atomic<char> phase;
+		};
+
+		// Only ever written by its owning thread. Event `i` lives in slot
+		// `i % TRACE_BUFFER_SIZE` and `count`, the number of events ever
+		// recorded, is published with a release store so the buffer can be
+		// dumped at any time.
+		struct TraceBuffer {
+			std::atomic<const char*> thread_name;
+			std::atomic<size_t> count;
+
+			std::array<TraceEvent, TRACE_BUFFER_SIZE> events;
+		};
+
+		inline const auto trace_epoch = std::chrono::steady_clock::now();
+
+#ifdef PACEMAKER_TRACING
+		inline std::array<TraceBuffer, TRACE_MAX_THREADS> trace_buffers;
+		inline std::atomic<size_t> trace_threads = 0;
+
+		// Events from threads that found every buffer claimed.
+		inline std::atomic<uint64_t> trace_unclaimed = 0;
+
+		inline thread_local TraceBuffer* trace_buffer = nullptr;
+
+		// Buffer of the calling thread, or `nullptr` if they've all been
+		// claimed by other threads.
+		inline TraceBuffer* claim_trace_buffer() {
+			if (trace_buffer) {
+				return trace_buffer;
+			}
+
+			size_t i = trace_threads.fetch_add(1, std::memory_order_relaxed);
+
+			if (i >= TRACE_MAX_THREADS) {
+				return nullptr;
+			}
+
+			trace_buffer = &trace_buffers[i];
+			return trace_buffer;
+		}
+#endif
+
+		inline void trace_record([[maybe_unused]] const char* name, [[maybe_unused]] char phase) {
+#ifdef PACEMAKER_TRACING
+			TraceBuffer* buffer = claim_trace_buffer();
+
+			if (not buffer) {
+				trace_unclaimed.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			size_t n = buffer->count.load(std::memory_order_relaxed);
+			auto elapsed = std::chrono::steady_clock::now() - trace_epoch;
+
+			auto& ev = buffer->events[n % TRACE_BUFFER_SIZE];
+			ev.name.store(name, std::memory_order_relaxed);
+			ev.nanoseconds.store(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+				std::memory_order_relaxed);
+			ev.phase.store(phase, std::memory_order_relaxed);
+
+			buffer->count.store(n + 1, std::memory_order_release);
+#endif
+		}
+
+		// Records a begin event now and the matching end event when it goes
+		// out of scope.
+		struct TraceSpan {
+			const char* name;
+
+			TraceSpan(const char* name_): name(name_) {
+				trace_record(name, 'B');
+			}
+
+			~TraceSpan() {
+				trace_record(name, 'E');
+			}
+
+			TraceSpan(const TraceSpan&) = delete;
+			TraceSpan& operator=(const TraceSpan&) = delete;
+		};
+	}  // namespace detail
+
+	// Name the calling thread in the trace.
+	inline void trace_thread_name([[maybe_unused]] const char* name) {
+#ifdef PACEMAKER_TRACING
+		if (auto* buffer = detail::claim_trace_buffer()) {
+			buffer->thread_name.store(name, std::memory_order_relaxed);
+		}
+#endif
+	}
+
+	// Dump the most recent events of every thread as Chrome trace JSON. Safe
+	// to call while other threads are still recording. Events that were
+	// overwritten before they could be dumped are counted in `dropped`, along
+	// with those from threads that didn't get a buffer.
+	inline void write_trace(std::ostream& os) {
+		os << "{\"traceEvents\": [";
+
+		[[maybe_unused]] bool first = true;
+		uint64_t dropped = 0;
+
+#ifdef PACEMAKER_TRACING
+		size_t threads = std::min(detail::trace_threads.load(std::memory_order_relaxed), TRACE_MAX_THREADS);
+
+		for (size_t tid = 0; tid != threads; ++tid) {
+			auto& buffer = detail::trace_buffers[tid];
+
+			if (const char* thread_name = buffer.thread_name.load(std::memory_order_relaxed)) {
+				os << (first ? "\n" : ",\n");
+				os << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+				   << ", \"args\": {\"name\": \"" << thread_name << "\"}}";
+				first = false;
+			}
+
+			size_t count = buffer.count.load(std::memory_order_acquire);
+			size_t oldest = count > TRACE_BUFFER_SIZE ? count - TRACE_BUFFER_SIZE : 0;
+
+			// Spans open in the dumped range. An end whose begin was
+			// overwritten is left out so every span is balanced.
+			size_t depth = 0;
+
+			for (size_t i = oldest; i != count; ++i) {
+				auto& ev = buffer.events[i % TRACE_BUFFER_SIZE];
+
+				const char* name = ev.name.load(std::memory_order_relaxed);
+				int64_t nanoseconds = ev.nanoseconds.load(std::memory_order_relaxed);
+				char phase = ev.phase.load(std::memory_order_relaxed);
+
+				// The owning thread may have lapped us while we read it.
+				std::atomic_thread_fence(std::memory_order_acquire);
+				size_t now = buffer.count.load(std::memory_order_relaxed);
+
+				if (now > TRACE_BUFFER_SIZE and i < now - TRACE_BUFFER_SIZE) {
+					depth = 0;
+					continue;
+				}
+
+				if (phase == 'B') {
+					++depth;
+				}
+				else if (phase == 'E') {
+					if (depth == 0) {
+						continue;
+					}
+
+					--depth;
+				}
+
+				os << (first ? "\n" : ",\n");
+				os << "{\"name\": \"" << name << "\", \"ph\": \"" << phase << "\", \"ts\": ";
+				os << nanoseconds / 1'000 << '.';
+				os << (nanoseconds / 100) % 10 << (nanoseconds / 10) % 10 << nanoseconds % 10;
+				os << ", \"pid\": 1, \"tid\": " << tid;
+
+				if (phase == 'i') {
+					os << ", \"s\": \"t\"";
+				}
+
+				os << "}";
+				first = false;
+			}
+
+			dropped += buffer.count.load(std::memory_order_relaxed) - (count - oldest);
+		}
+
+		dropped += detail::trace_unclaimed.load(std::memory_order_relaxed);
+#endif
+
+		os << "\n], \"otherData\": {\"dropped\": " << dropped << "}}\n";
+	}
+}  // namespace pacemaker
+
+#ifdef PACEMAKER_TRACING
+	#define PACEMAKER_SPAN(name)    pacemaker::detail::TraceSpan PACEMAKER_VAR(span) { name }
+	#define PACEMAKER_INSTANT(name) pacemaker::detail::trace_record(name, 'i')
+#else
+	#define PACEMAKER_SPAN(name) \
+		do { \
+		} while (0)
+	#define PACEMAKER_INSTANT(name) \
+		do { \
+		} while (0)
+#endif
+
+#endif
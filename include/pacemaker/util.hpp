@@ -3,10 +3,18 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <filesystem>
 #include <iostream>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <cstdint>
+
+#include <pacemaker/queue.hpp>
 
 // Macros
 namespace pacemaker {
@@ -89,11 +97,23 @@ namespace pacemaker {
 
 #ifndef NDEBUG
 	namespace detail {
+		// Strip the working directory from a path. The working directory is
+		// only looked up once rather than for every call.
+		inline std::string_view relative_path(std::string_view file) {
+			static const std::string cwd = std::filesystem::current_path().native() + '/';
+
+			if (file.starts_with(cwd)) {
+				file.remove_prefix(cwd.size());
+			}
+
+			return file;
+		}
+
 		template <typename T>
 		inline decltype(auto) dbg_impl(const char* file, const char* line, const char* expr_s, T&& expr) {
 			println(std::cerr,
 				"[",
-				std::filesystem::relative(file).native(),
+				relative_path(file),
 				":",
 				line,
 				"] ",
@@ -149,14 +169,220 @@ namespace pacemaker {
 		return print(os, detail::log_to_str(x));
 	}
 
+	// Real-time safe logging.
+	// Threads owned by JACK must not allocate or lock so log calls made from
+	// them copy their arguments into a fixed size record on a preallocated
+	// ring instead of formatting. `LogDrain` formats and prints the records
+	// from a background thread.
+	namespace detail {
+		constexpr size_t LOG_MAX_ARGS = 8;
+		constexpr size_t LOG_MAX_STR = 40;
+		constexpr size_t LOG_RING_SIZE = 256;
+
+		constexpr auto LOG_DRAIN_INTERVAL = std::chrono::milliseconds { 10 };
+
+		enum class LogArgKind : uint8_t {
+			INT,
+			UINT,
+			FLOAT,
+			STR,
+		};
+
+		struct LogArg {
+			LogArgKind kind;
+
+			union {
+				int64_t i;
+				uint64_t u;
+				double f;
+				char s[LOG_MAX_STR];
+			};
+		};
+
+		struct LogRecord {
+			LogLevel level;
+
+			// Both `nullptr` for `info`/`warning`/... style records.
+			const char* trace;
+			const char* fn;
+
+			size_t argc;
+			std::array<LogArg, LOG_MAX_ARGS> args;
+		};
+
+		// Set on threads where we must not allocate or block.
+		inline thread_local bool rt_context = false;
+
+		// Marks the current thread as real-time for the lifetime of the scope.
+		struct RtScope {
+			bool previous;
+
+			RtScope(): previous(std::exchange(rt_context, true)) {}
+
+			~RtScope() {
+				rt_context = previous;
+			}
+		};
+
+		inline pacemaker::MpscQueue<LogRecord, LOG_RING_SIZE> log_ring;
+
+		inline void encode_str(LogArg& arg, std::string_view sv) {
+			size_t n = std::min(sv.size(), LOG_MAX_STR - 1);
+
+			arg.kind = LogArgKind::STR;
+			std::copy_n(sv.data(), n, arg.s);
+			arg.s[n] = '\0';
+		}
+
+		template <typename T>
+		inline void encode(LogArg& arg, const T& x) {
+			using U = std::decay_t<T>;
+
+			if constexpr (std::is_same_v<U, bool>) {
+				arg.kind = LogArgKind::UINT;
+				arg.u = x;
+			}
+			else if constexpr (std::is_same_v<U, char>) {
+				encode_str(arg, std::string_view { &x, 1 });
+			}
+			else if constexpr (std::is_array_v<T>) {
+				encode_str(arg, x);
+			}
+			else if constexpr (std::is_same_v<U, const char*> or std::is_same_v<U, char*>) {
+				encode_str(arg, x ? x : "(null)");
+			}
+			else if constexpr (std::is_integral_v<U> and std::is_signed_v<U>) {
+				arg.kind = LogArgKind::INT;
+				arg.i = x;
+			}
+			else if constexpr (std::is_integral_v<U>) {
+				arg.kind = LogArgKind::UINT;
+				arg.u = x;
+			}
+			else if constexpr (std::is_floating_point_v<U>) {
+				arg.kind = LogArgKind::FLOAT;
+				arg.f = x;
+			}
+			else if constexpr (std::is_enum_v<U>) {
+				encode(arg, static_cast<std::underlying_type_t<U>>(x));
+			}
+			else if constexpr (std::is_convertible_v<const U&, std::string_view>) {
+				encode_str(arg, x);
+			}
+			else if constexpr (requires { x.count(); }) {  // std::chrono::duration
+				encode(arg, x.count());
+			}
+			else {
+				encode_str(arg, "?");
+			}
+		}
+
+		// Never allocates or blocks. Arguments past `LOG_MAX_ARGS` are
+		// dropped, as is the whole record if the ring is full.
+		template <typename... Ts>
+		inline void rt_log(LogLevel level, const char* trace, const char* fn, Ts&&... args) {
+			LogRecord record { level, trace, fn, 0, {} };
+
+			(
+				[&](const auto& arg) {
+					if (record.argc < LOG_MAX_ARGS) {
+						encode(record.args[record.argc++], arg);
+					}
+				}(args),
+				...);
+
+			log_ring.push(record);
+		}
+
+		inline std::ostream& operator<<(std::ostream& os, const LogArg& arg) {
+			switch (arg.kind) {
+				case LogArgKind::INT: return (os << arg.i);
+				case LogArgKind::UINT: return (os << arg.u);
+				case LogArgKind::FLOAT: return (os << arg.f);
+				case LogArgKind::STR: return (os << arg.s);
+			}
+
+			return os;
+		}
+
+		// Mirrors the output of `PACEMAKER_LOG` and `info`/`warning`/...
+		inline void print_record(std::ostream& os, const LogRecord& record) {
+			using namespace std::string_view_literals;
+
+			if (record.trace) {
+				print(os, record.level, " ", record.trace);
+
+				if (record.fn != "operator()"sv) {
+					print(os, "`", record.fn, "` ");
+				}
+			}
+			else {
+				print(os, record.level, " ");
+			}
+
+			print(os, PACEMAKER_RESET);
+
+			for (size_t i = 0; i != record.argc; ++i) {
+				os << record.args[i];
+			}
+
+			print(os, '\n', PACEMAKER_RESET);
+		}
+	}  // namespace detail
+
+	// Background thread printing records logged from real-time threads.
+	// Only one should exist at a time since it is the ring's sole consumer.
+	struct LogDrain {
+		std::jthread thread;
+
+		LogDrain():
+				thread([](std::stop_token stop) {
+					size_t dropped = 0;
+
+					while (not stop.stop_requested()) {
+						flush(dropped);
+						std::this_thread::sleep_for(detail::LOG_DRAIN_INTERVAL);
+					}
+
+					flush(dropped);
+				}) {}
+
+		static void flush(size_t& dropped) {
+			detail::LogRecord record;
+
+			while (detail::log_ring.pop(record)) {
+				detail::print_record(std::cerr, record);
+			}
+
+			if (size_t overflows = detail::log_ring.overflows(); overflows != dropped) {
+				println(std::cerr,
+					detail::log_to_str(LogLevel::WRN),
+					" dropped ",
+					overflows - dropped,
+					" real-time log records",
+					PACEMAKER_RESET);
+
+				dropped = overflows;
+			}
+		}
+	};
+
 	// Errors/Warnings
 	template <typename... Ts>
 	inline void info(Ts&&... args) {
+		if (detail::rt_context) {
+			return detail::rt_log(LogLevel::INF, nullptr, nullptr, std::forward<Ts>(args)...);
+		}
+
 		println(std::cerr, detail::log_to_str(LogLevel::INF), " ", std::forward<Ts>(args)..., PACEMAKER_RESET);
 	}
 
 	template <typename... Ts>
 	inline void warning(Ts&&... args) {
+		if (detail::rt_context) {
+			return detail::rt_log(LogLevel::WRN, nullptr, nullptr, std::forward<Ts>(args)...);
+		}
+
 		println(std::cerr, detail::log_to_str(LogLevel::WRN), " ", std::forward<Ts>(args)..., PACEMAKER_RESET);
 	}
 
@@ -168,11 +394,19 @@ namespace pacemaker {
 
 	template <typename... Ts>
 	inline void error(Ts&&... args) {
+		if (detail::rt_context) {
+			return detail::rt_log(LogLevel::ERR, nullptr, nullptr, std::forward<Ts>(args)...);
+		}
+
 		println(std::cerr, detail::log_to_str(LogLevel::ERR), " ", std::forward<Ts>(args)..., PACEMAKER_RESET);
 	}
 
 	template <typename... Ts>
 	inline void ok(Ts&&... args) {
+		if (detail::rt_context) {
+			return detail::rt_log(LogLevel::OK, nullptr, nullptr, std::forward<Ts>(args)...);
+		}
+
 		println(std::cerr, detail::log_to_str(LogLevel::OK), " ", std::forward<Ts>(args)..., PACEMAKER_RESET);
 	}
 
@@ -180,6 +414,14 @@ namespace pacemaker {
 	do { \
 		[PACEMAKER_VAR(fn_name) = __func__](pacemaker::LogLevel PACEMAKER_VAR(x), auto&&... PACEMAKER_VAR(args)) { \
 			using namespace std::string_view_literals; \
+\
+			if (pacemaker::detail::rt_context) { \
+				PACEMAKER_DBG_RUN((pacemaker::detail::rt_log(PACEMAKER_VAR(x), \
+					PACEMAKER_TRACE, \
+					PACEMAKER_VAR(fn_name), \
+					std::forward<decltype(PACEMAKER_VAR(args))>(PACEMAKER_VAR(args))...))); \
+				return; \
+			} \
 \
 			PACEMAKER_DBG_RUN((pacemaker::print(std::cerr, PACEMAKER_VAR(x), " ", PACEMAKER_TRACE))); \
 \
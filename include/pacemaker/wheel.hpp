@@ -0,0 +1,203 @@
+#ifndef PACEMAKER_WHEEL_HPP
+#define PACEMAKER_WHEEL_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <limits>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <pacemaker/timing.hpp>
+#include <pacemaker/sequencer.hpp>
+#include <pacemaker/batch.hpp>
+#include <pacemaker/trace.hpp>
+
+// Event generation for patches with a very large number of sparse channels.
+// `BatchRenderer` looks at every channel for every window, this keeps each
+// channel's next event in a hierarchical timing wheel instead so rendering a
+// window only touches the channels that fire in it.
+namespace pacemaker {
+	// Resolution of the wheel. Channels due within the same tick share a
+	// slot, it has no effect on event timestamps.
+	constexpr auto WHEEL_TICK = std::chrono::milliseconds { 1 };
+
+	// Every level has 64 slots, each covering 64 times as many ticks as the
+	// level below. Six levels span a little over two years at the default
+	// tick, anything further out is parked in the last slot and re-filed
+	// when it gets cascaded.
+	constexpr size_t WHEEL_BITS = 6;
+	constexpr size_t WHEEL_SLOTS = size_t { 1 } << WHEEL_BITS;
+	constexpr size_t WHEEL_LEVELS = 6;
+
+	// Renders consecutive windows of a compiled patch like `BatchRenderer`
+	// and produces the same events. Rendering a window that doesn't start
+	// where the last one ended, or a different patch (even one in the same
+	// place), rebuilds the wheel in O(channels).
+	struct WheelRenderer {
+		static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+		const pacemaker::CompiledPatch* patch = nullptr;
+		uint64_t serial = 0;
+
+		pacemaker::Unit tick;
+
+		// Where the last window ended.
+		pacemaker::Unit cursor {};
+
+		// Every tick before `now` has been processed and level 0 holds
+		// everything due in `now`.
+		int64_t now = 0;
+
+		// Each slot is an intrusive singly linked list of channels threaded
+		// through `link`.
+		std::array<std::array<uint32_t, WHEEL_SLOTS>, WHEEL_LEVELS> slots;
+		std::pmr::vector<uint32_t> link;
+
+		// Index of each channel's next event, `phase + period * index`.
+		std::pmr::vector<int64_t> index;
+
+		pacemaker::BatchRenderer batch;
+
+		WheelRenderer(pacemaker::Unit tick_ = WHEEL_TICK,
+			std::pmr::memory_resource* resource = std::pmr::get_default_resource()):
+				tick(tick_), link(resource), index(resource), batch(resource) {}
+
+		// Returns every event in [begin, end). The reference is valid until
+		// the next call.
+		const pacemaker::pmr::Timeline& render(
+			pacemaker::Unit begin, pacemaker::Unit end, const pacemaker::CompiledPatch& p) {
+			PACEMAKER_SPAN("render_wheel");
+
+			if (&p != patch or p.serial != serial or begin != cursor) {
+				reset(begin, p);
+			}
+
+			batch.runs.clear();
+
+			if (end > begin) {
+				int64_t last = detail::floor_div((end - pacemaker::Unit { 1 }).count(), tick.count());
+
+				while (true) {
+					fire(end);
+
+					if (now == last) {
+						break;
+					}
+
+					advance();
+				}
+
+				cursor = end;
+			}
+
+			return batch.render_runs();
+		}
+
+		// File every channel at its first event at or after `begin`.
+		void reset(pacemaker::Unit begin, const pacemaker::CompiledPatch& p) {
+			patch = &p;
+			serial = p.serial;
+			cursor = begin;
+			now = detail::floor_div(begin.count(), tick.count());
+
+			for (auto& level: slots) {
+				level.fill(NONE);
+			}
+
+			link.assign(p.size(), NONE);
+			index.resize(p.size());
+
+			for (size_t ch = 0; ch != p.size(); ++ch) {
+				index[ch] = detail::event_index(begin, p.period[ch], p.phase[ch]);
+				insert(static_cast<uint32_t>(ch));
+			}
+		}
+
+		pacemaker::Unit next_event(uint32_t ch) const {
+			return patch->phase[ch] + patch->period[ch] * index[ch];
+		}
+
+		void insert(uint32_t ch) {
+			int64_t expiry = detail::floor_div(next_event(ch).count(), tick.count());
+			auto delta = static_cast<uint64_t>(std::max<int64_t>(expiry - now, 0));
+
+			size_t level = delta == 0 ? 0 : (static_cast<size_t>(std::bit_width(delta)) - 1) / WHEEL_BITS;
+
+			// Too far out, park it in the slot that gets cascaded last.
+			if (level >= WHEEL_LEVELS) {
+				level = WHEEL_LEVELS - 1;
+				expiry = now + (int64_t { WHEEL_SLOTS - 1 } << (WHEEL_BITS * level));
+			}
+
+			auto& head = slots[level][slot(expiry, level)];
+			link[ch] = head;
+			head = ch;
+		}
+
+		static size_t slot(int64_t tick_index, size_t level) {
+			return static_cast<size_t>(tick_index >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+		}
+
+		// Unlink every channel in a slot.
+		uint32_t take(size_t level, size_t i) {
+			return std::exchange(slots[level][i], NONE);
+		}
+
+		// Move to the next tick, redistributing the higher levels whenever
+		// the one below wraps around.
+		void advance() {
+			++now;
+
+			for (size_t level = 1; level != WHEEL_LEVELS; ++level) {
+				if (slot(now, level - 1) != 0) {
+					break;
+				}
+
+				for (uint32_t ch = take(level, slot(now, level)); ch != NONE;) {
+					uint32_t next = link[ch];
+					insert(ch);
+					ch = next;
+				}
+			}
+		}
+
+		// Turn every channel due in the current tick and before `end` into a
+		// run and re-file it at its first event after the window.
+		void fire(pacemaker::Unit end) {
+			auto& p = *patch;
+
+			for (uint32_t ch = take(0, slot(now, 0)); ch != NONE;) {
+				uint32_t next = link[ch];
+				pacemaker::Unit first = next_event(ch);
+
+				if (first < end) {
+					auto count = detail::ceil_div((end - first).count(), p.period[ch].count());
+
+					batch.runs.push_back({
+						first,
+						p.period[ch],
+						p.status[ch],
+						p.port[ch],
+						p.notes.data() + p.note_offset[ch],
+						p.note_count[ch],
+						static_cast<uint32_t>(detail::phase(index[ch], p.note_count[ch])),
+						static_cast<size_t>(count),
+					});
+
+					index[ch] += count;
+				}
+
+				insert(ch);
+				ch = next;
+			}
+		}
+	};
+}  // namespace pacemaker
+
+#endif
@@ -5,18 +5,26 @@
 #include <exception>
 #include <jack/jack.h>
 #include <jack/types.h>
+#include <algorithm>
 #include <utility>
 #include <chrono>
 #include <iostream>
+#include <fstream>
+#include <iterator>
+#include <charconv>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <atomic>
 #include <thread>
 #include <vector>
+#include <memory>
+#include <optional>
 #include <compare>
+#include <limits>
 
 #include <cmath>
+#include <csignal>
 #include <cstdint>
 
 #include <conflict/conflict.hpp>
@@ -24,105 +32,571 @@
 #include <lexy/action/parse.hpp>
 #include <lexy/callback.hpp>
 #include <lexy/dsl.hpp>
+#include <lexy_ext/report_error.hpp>
 
 #include <pacemaker/pacemaker.hpp>
+#include <pacemaker/parser.hpp>
 
-int main([[maybe_unused]] int argc, [[maybe_unused]] const char* argv[]) {
-	try {
+namespace {
+	volatile std::sig_atomic_t running = 1;
+
+	volatile std::sig_atomic_t dump_trace = 0;
+
+	void stop_handler(int) {
+		running = 0;
+	}
+
+	void trace_handler(int) {
+		dump_trace = 1;
+	}
+
+	struct Options {
+		// Output port `i` is connected to the first input matching `ports[i]`.
+		std::vector<std::string_view> ports;
+
+		// Input port `i` is connected to the first output matching `inputs[i]`.
+		std::vector<std::string_view> inputs;
+
+		// Append everything received on the input ports to this file.
+		std::string_view capture;
+
+		// Forward input events to this output port, transposed by `transpose`
+		// semitones.
+		int64_t thru = -1;
+		int64_t transpose = 0;
+
+		// Load the patch from this file instead of using the default.
+		std::string_view patch;
+
+		// Periodically write real-time statistics to this file.
+		std::string_view stats;
+
+		// Dump trace spans to this file on exit or on `SIGUSR1`.
+		std::string_view trace;
+
+		// Lock all memory before starting and run the writer on `cpus` under
+		// `SCHED_FIFO` at `priority` (unless zero).
+		bool mlock = false;
+		std::vector<int> cpus;
+		int64_t priority = 0;
+
+		// Accept control commands on a UNIX datagram socket at this path.
+		std::string_view control;
+
+		// Play a timeline file made with `--render --timeline` instead of the
+		// patch, starting `seek` into it.
+		std::string_view play;
+		pacemaker::Unit seek {};
+
+		// Render to this file instead of connecting to JACK.
+		std::string_view render;
+		pacemaker::Unit duration = std::chrono::seconds { 60 };
+		bool raw = false;
+		bool timeline = false;
+	};
+
+	int64_t parse_integer(std::string_view value, int64_t min, int64_t max) {
+		int64_t x = 0;
+		auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), x);
+
+		if (ec != std::errc {} or ptr != value.data() + value.size() or x < min or x > max) {
+			pacemaker::fatal_error("invalid value `", value, "`");
+		}
+
+		return x;
+	}
+
+	// Comma separated CPUs or ranges of them, like `2,4-7`.
+	std::vector<int> parse_cpus(std::string_view value) {
+		std::vector<int> cpus;
+
+		while (not value.empty()) {
+			std::string_view item = value.substr(0, value.find(','));
+			value.remove_prefix(std::min(item.size() + 1, value.size()));
+
+			auto dash = item.find('-');
+			auto first = parse_integer(item.substr(0, dash), 0, CPU_SETSIZE - 1);
+			auto last = first;
+
+			if (dash != std::string_view::npos) {
+				last = parse_integer(item.substr(dash + 1), first, CPU_SETSIZE - 1);
+			}
+
+			for (auto cpu = first; cpu <= last; ++cpu) {
+				cpus.push_back(static_cast<int>(cpu));
+			}
+		}
+
+		if (cpus.empty()) {
+			pacemaker::fatal_error("no CPUs given");
+		}
+
+		return cpus;
+	}
+
+	Options parse_args(int argc, const char* argv[]) {
 		using namespace std::literals;
 
-		PACEMAKER_LOG(pacemaker::LogLevel::OK, "starting");
+		Options opts;
+
+		for (int i = 1; i < argc; ++i) {
+			std::string_view arg = argv[i];
+
+			if (arg == "--render"sv and i + 1 < argc) {
+				opts.render = argv[++i];
+			}
+			else if (arg == "--duration"sv and i + 1 < argc) {
+				auto seconds = parse_integer(argv[++i], 1, std::numeric_limits<int32_t>::max());
+				opts.duration = std::chrono::seconds { seconds };
+			}
+			else if (arg == "--patch"sv and i + 1 < argc) {
+				opts.patch = argv[++i];
+			}
+			else if (arg == "--stats"sv and i + 1 < argc) {
+				opts.stats = argv[++i];
+			}
+			else if (arg == "--input"sv and i + 1 < argc) {
+				opts.inputs.push_back(argv[++i]);
+			}
+			else if (arg == "--capture"sv and i + 1 < argc) {
+				opts.capture = argv[++i];
+			}
+			else if (arg == "--thru"sv and i + 1 < argc) {
+				opts.thru = parse_integer(argv[++i], 0, pacemaker::MAX_PORTS - 1);
+			}
+			else if (arg == "--transpose"sv and i + 1 < argc) {
+				opts.transpose = parse_integer(argv[++i], -127, 127);
+			}
+			else if (arg == "--trace"sv and i + 1 < argc) {
+				opts.trace = argv[++i];
+			}
+			else if (arg == "--mlock"sv) {
+				opts.mlock = true;
+			}
+			else if (arg == "--cpus"sv and i + 1 < argc) {
+				opts.cpus = parse_cpus(argv[++i]);
+			}
+			else if (arg == "--priority"sv and i + 1 < argc) {
+				opts.priority = parse_integer(argv[++i], 1, 99);
+			}
+			else if (arg == "--control"sv and i + 1 < argc) {
+				opts.control = argv[++i];
+			}
+			else if (arg == "--raw"sv) {
+				opts.raw = true;
+			}
+			else if (arg == "--timeline"sv) {
+				opts.timeline = true;
+			}
+			else if (arg == "--play"sv and i + 1 < argc) {
+				opts.play = argv[++i];
+			}
+			else if (arg == "--seek"sv and i + 1 < argc) {
+				opts.seek = std::chrono::seconds { parse_integer(argv[++i], 0, std::numeric_limits<int32_t>::max()) };
+			}
+			else if (not arg.starts_with('-')) {
+				opts.ports.push_back(arg);
+			}
+			else {
+				pacemaker::fatal_error(pacemaker::STR_USAGE);
+			}
+		}
+
+		if (opts.render.empty() and opts.ports.empty()) {
+			pacemaker::fatal_error(pacemaker::STR_USAGE);
+		}
+
+		if (not opts.trace.empty() and not pacemaker::TRACING) {
+			pacemaker::warning("built without `PACEMAKER_TRACING`, the trace will be empty");
+		}
+
+		return opts;
+	}
+
+	pacemaker::Patch load_patch(std::string_view path) {
+		std::ifstream is { std::string { path } };
+
+		if (not is) {
+			pacemaker::fatal_error("could not open `", path, "`");
+		}
+
+		std::string src { std::istreambuf_iterator<char> { is }, std::istreambuf_iterator<char> {} };
+
+		// `path` points into argv so it's null terminated.
+		auto patch = pacemaker::parse_patch(src, lexy_ext::report_error.path(path.data()));
+
+		if (not patch) {
+			pacemaker::fatal_error("could not parse `", path, "`");
+		}
+
+		return std::move(*patch);
+	}
+
+	void write_trace(std::string_view path) {
+		std::ofstream os { std::string { path } };
+
+		if (not os) {
+			pacemaker::warning("could not write trace to `", path, "`");
+			return;
+		}
+
+		pacemaker::write_trace(os);
+	}
+
+	// Render the patch as fast as possible without touching JACK.
+	void render(const Options& opts, const pacemaker::Patch& patch) {
+		std::vector<char> buffer(1 << 20);
+		std::ofstream os;
+
+		os.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		os.open(std::string { opts.render }, std::ios::binary);
+
+		if (not os) {
+			pacemaker::fatal_error("could not open `", opts.render, "`");
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		size_t count = 0;
+
+		if (opts.timeline) {
+			count = pacemaker::write_timeline(os, pacemaker::Unit { 0 }, opts.duration, patch);
+		}
+		else if (opts.raw) {
+			count = pacemaker::write_dump(os, pacemaker::Unit { 0 }, opts.duration, patch);
+		}
+		else {
+			count = pacemaker::write_smf(os, pacemaker::Unit { 0 }, opts.duration, patch);
+		}
+
+		os.flush();
+
+		if (not os) {
+			pacemaker::fatal_error("could not write `", opts.render, "`");
+		}
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		pacemaker::ok("rendered ",
+			count,
+			" events in ",
+			elapsed.count(),
+			"s (",
+			static_cast<double>(count) / elapsed.count(),
+			" events/s)");
+	}
+
+	void live(const Options& opts, const pacemaker::Patch& default_patch) {
+		using namespace std::literals;
 
 		pacemaker::JackClient client;
-		auto& port = client.port_register_output(pacemaker::STR_CLIENT_NAME);
+
+		std::optional<pacemaker::MappedTimeline> arrangement;
+
+		if (not opts.play.empty()) {
+			arrangement.emplace(std::string { opts.play });
+		}
+
+		// One output per port pattern and enough for every channel's routing.
+		size_t n_outputs = opts.ports.size();
+
+		for (auto& ch: default_patch) {
+			n_outputs = std::max<size_t>(n_outputs, ch.port + 1u);
+		}
+
+		n_outputs = std::max<size_t>(n_outputs, static_cast<size_t>(opts.thru + 1));
+
+		if (arrangement) {
+			n_outputs = std::max<size_t>(n_outputs, arrangement->header.ports);
+		}
+
+		for (size_t i = 0; i != n_outputs; ++i) {
+			std::string name = pacemaker::STR_CLIENT_NAME;
+
+			if (i != 0) {
+				name += "_" + std::to_string(i);
+			}
+
+			client.port_register_output(name);
+		}
 
 		PACEMAKER_LOG(pacemaker::LogLevel::OK, "collecting ports");
 
-		PACEMAKER_ASSERT(argc > 1);
-		auto ports = client.get_input_ports(argv[1]);
+		for (size_t i = 0; i != opts.ports.size(); ++i) {
+			auto ports = client.get_input_ports(std::string { opts.ports[i] });
 
-		pacemaker::println(std::cerr, "matches:");
-		for (auto& p: ports) {
-			pacemaker::println(std::cerr, p);
+			pacemaker::println(std::cerr, "matches:");
+			for (auto& p: ports) {
+				pacemaker::println(std::cerr, p);
+			}
+
+			PACEMAKER_ASSERT(not ports.empty());
+			PACEMAKER_ASSERT(client.ports[i].connect(ports.front()));
 		}
 
-		PACEMAKER_ASSERT(port.connect(ports.front()));
-		PACEMAKER_ASSERT(client.ready());
+		// Inputs are only read when capturing or forwarding but then always
+		// get a port to be connected to, even without a pattern.
+		size_t n_inputs = opts.inputs.size();
 
-		PACEMAKER_LOG(pacemaker::LogLevel::OK, "ready");
+		if (not opts.capture.empty() or opts.thru >= 0) {
+			n_inputs = std::max<size_t>(n_inputs, 1);
+		}
 
-		std::this_thread::sleep_for(1s);
+		for (size_t i = 0; i != n_inputs; ++i) {
+			client.port_register_input(
+				pacemaker::STR_CLIENT_NAME + "_in"s + (i == 0 ? ""s : "_"s + std::to_string(i)));
+		}
 
-		// pacemaker::Unit buffer_size = 5s;
-		// auto default_patch = pacemaker::Patch {
-		// 	pacemaker::Channel { { 0, pacemaker::MIDI_NOTE_ON }, 2s, 0s, pacemaker::Notes { 64 } },
-		// 	pacemaker::Channel { { 0, pacemaker::MIDI_NOTE_OFF }, 2s, 1s, pacemaker::Notes { 64 } },
-		// };
+		for (size_t i = 0; i != opts.inputs.size(); ++i) {
+			auto ports = client.get_output_ports(std::string { opts.inputs[i] });
 
-		// pacemaker::Timeline timeline_reader;
-		// pacemaker::Timeline::iterator it;
+			PACEMAKER_ASSERT(not ports.empty());
+			PACEMAKER_ASSERT(client.inputs[i].connect(ports.front()));
+		}
 
-		// std::atomic_bool writer_ready = false;
-		// std::atomic_bool reader_ready = false;
+		std::optional<pacemaker::CaptureFile> capture;
 
-		// client.set_callback([&](jack_nframes_t frames) {
-		// 	using namespace std::literals;
-		// 	using namespace pacemaker;
+		if (not opts.capture.empty()) {
+			capture.emplace(client.enable_capture(), std::string { opts.capture });
+		}
 
-		// 	void* buffer = port.get_buffer(frames);
-		// 	jack_midi_clear_buffer(buffer);
+		if (opts.thru >= 0) {
+			pacemaker::ThruRule rule;
+			rule.transpose = static_cast<int>(opts.transpose);
+			rule.port = static_cast<pacemaker::PortIndex>(opts.thru);
 
-		// 	if (writer_ready) {
-		// 		return 0;
-		// 	}
+			client.enable_thru().publish({ rule });
+		}
 
-		// 	jack_nframes_t current_frames;
-		// 	jack_time_t current_usecs;
-		// 	jack_time_t next_usecs;
-		// 	float period_usecs;
+		auto& refill = client.enable_refill();
 
-		// 	jack_get_cycle_times(client, &current_frames, &current_usecs, &next_usecs, &period_usecs);
+		if (not opts.control.empty()) {
+			client.enable_control();
+		}
 
-		// 	Unit current = std::chrono::duration_cast<Unit>(std::chrono::microseconds { current_usecs });
+		// The writer has to stay below JACK's process thread or it could
+		// preempt it.
+		int jack_priority = client.backend->real_time_priority();
+		int writer_priority = static_cast<int>(opts.priority);
 
-		// 	for (; it != timeline_reader.end() and it->timestamp <= current; ++it) {
-		// 		jack_midi_event_write(buffer, 0, it->midi.data(), it->midi.size());
-		// 	}
+		if (jack_priority < 0) {
+			pacemaker::warning("JACK is not running in real-time");
 
-		// 	if (it == timeline_reader.end()) {
-		// 		reader_ready = true;
-		// 	}
+			if (writer_priority != 0) {
+				pacemaker::warning("not raising the writer's priority above JACK's");
+				writer_priority = 0;
+			}
+		}
+		else {
+			PACEMAKER_LOG(pacemaker::LogLevel::OK, "JACK real-time priority is ", jack_priority);
 
-		// 	return 0;
-		// });
+			if (writer_priority >= jack_priority) {
+				pacemaker::fatal_error("--priority must be below JACK's (", jack_priority, ")");
+			}
+		}
 
-		// PACEMAKER_ASSERT(client.ready());
-		// PACEMAKER_ASSERT(port.connect("lmms:MIDI in"));
+		if (opts.mlock) {
+			pacemaker::lock_memory();
+		}
 
-		// PACEMAKER_LOG(pacemaker::LogLevel::OK, "ready");
+		client.prefault();
 
-		// while (true) {
-		// 	jack_nframes_t current_frames = jack_frame_time(client);
-		// 	jack_time_t current_time = jack_frames_to_time(client, current_frames);
+		// Edits from the control socket, only the writer touches the rest.
+		pacemaker::HotSwap<const pacemaker::PatchEdit> edits;
+		pacemaker::TempoMap tempo_map { default_patch };
+		pacemaker::CompiledPatch patch { default_patch };
 
-		// 	auto current = std::chrono::duration_cast<pacemaker::Unit>(std::chrono::microseconds { current_time });
+		// Render the longest window the writer can ask for once, so the
+		// renderer's buffers are allocated and mapped before anything plays.
+		pacemaker::WheelRenderer renderer;
 
-		// 	auto begin = pacemaker::detail::event_at(current + buffer_size, buffer_size);
-		// 	auto end = begin + buffer_size;
+		if (not arrangement) {
+			renderer.render(pacemaker::Unit {}, pacemaker::REFILL_MAX_LOOKAHEAD, patch);
+		}
+
+		PACEMAKER_ASSERT(client.ready());
+
+		std::optional<pacemaker::StatsFile> stats;
+
+		if (not opts.stats.empty()) {
+			stats.emplace(client.stats, std::string { opts.stats });
+		}
+
+		PACEMAKER_LOG(pacemaker::LogLevel::OK, "ready");
+
+		// Generates events one window at a time and hands them to the process
+		// callback through each port's queue. It sleeps until the process
+		// callback reports that the queued lookahead is running low and then
+		// fills up to the high-water mark, which adapts to the period and to
+		// how long waking up and refilling take. Edits are only picked up
+		// between windows, at the start of the next one, and carry on from
+		// the first event the old patch had there.
+		//
+		// When playing an arrangement its events are read straight out of the
+		// mapping instead, shifted so that `opts.seek` lands on the start.
+		std::jthread writer([&](std::stop_token stop) {
+			pacemaker::trace_thread_name("writer");
+
+			if (not opts.cpus.empty()) {
+				pacemaker::pin_thread(opts.cpus);
+			}
+
+			if (writer_priority != 0) {
+				pacemaker::set_fifo_priority(writer_priority);
+			}
+
+			pacemaker::prefault_stack();
+
+			pacemaker::Unit begin = client.now();
+			pacemaker::Unit shift = begin - opts.seek;
+
+			std::stop_callback wake { stop, [&] { refill.post(); } };
+
+			const pacemaker::PatchEdit* edit = nullptr;
+
+			// Returns `false` if we were stopped while waiting for room.
+			auto send = [&](const pacemaker::Event& ev) {
+				// Patches swapped in later can't add ports.
+				if (ev.port >= client.ports.size()) {
+					return true;
+				}
+
+				while (not client.ports[ev.port].send(ev)) {
+					if (stop.stop_requested()) {
+						return false;
+					}
+
+					refill.waiting_for_room.store(true, std::memory_order_relaxed);
+					refill.wait(pacemaker::REFILL_TIMEOUT);
+				}
+
+				refill.waiting_for_room.store(false, std::memory_order_relaxed);
+
+				return true;
+			};
+
+			while (not stop.stop_requested()) {
+				// The old patch has nothing between `begin` and where the new
+				// one starts, so that's queued as well.
+				if (const auto* next = edits.acquire(); next != edit and not arrangement) {
+					edit = next;
+					begin = tempo_map.apply(*edit, begin);
+					patch = pacemaker::CompiledPatch { tempo_map.playing };
+
+					refill.set_horizon(begin);
+				}
+
+				pacemaker::Unit now = client.now();
+				pacemaker::Unit end = refill.target(now);
+
+				refill.woken(now);
+
+				if (end <= begin) {
+					refill.wait(pacemaker::REFILL_TIMEOUT);
+					continue;
+				}
+
+				auto start = std::chrono::steady_clock::now();
+
+				if (arrangement) {
+					PACEMAKER_SPAN("push");
+
+					for (const auto& ev: arrangement->between(begin - shift, end - shift)) {
+						if (not send({ ev.timestamp + shift, ev.midi, ev.port })) {
+							return;
+						}
+					}
+				}
+				else {
+					const auto& events = renderer.render(begin, end, patch);
+
+					PACEMAKER_SPAN("push");
+
+					for (const auto& ev: events) {
+						if (not send(ev)) {
+							return;
+						}
+					}
+				}
+
+				begin = end;
+				refill.set_horizon(begin);
+				refill.refilled(std::chrono::steady_clock::now() - start);
+
+				refill.wait(pacemaker::REFILL_TIMEOUT);
+			}
+		});
+
+		// Decodes commands off the real-time path. Mutes go to the process
+		// callback, everything else is compiled into a new patch for the
+		// writer.
+		std::optional<pacemaker::ControlSocket> control;
+
+		if (client.control) {
+			auto parse = [](std::string_view src) {
+				return pacemaker::parse_patch(src, lexy_ext::report_error);
+			};
+
+			control.emplace(std::string { opts.control }, *client.control, edits, default_patch, parse);
+
+			PACEMAKER_LOG(pacemaker::LogLevel::OK, "listening on `", opts.control, "`");
+		}
+
+		std::signal(SIGINT, stop_handler);
+		std::signal(SIGTERM, stop_handler);
+
+		if (not opts.trace.empty()) {
+			std::signal(SIGUSR1, trace_handler);
+		}
 
-		// 	auto timeline_writer = pacemaker::timeline(begin, end, default_patch);
+		while (running) {
+			std::this_thread::sleep_for(100ms);
 
-		// 	PACEMAKER_LOG(pacemaker::LogLevel::OK, "buffer generated! ", begin, " -> ", end);
-		// 	writer_ready = true;
+			if (dump_trace) {
+				dump_trace = 0;
+				write_trace(opts.trace);
+			}
+		}
+
+		// Stop everything feeding or fed by the process callback, then the
+		// callback itself, before the capture file is closed so nothing read
+		// while shutting down is lost.
+		control.reset();
+
+		writer.request_stop();
+		writer.join();
+
+		client.stop();
+	}
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+	try {
+		using namespace std::literals;
 
-		// 	while (not reader_ready) {}
+		PACEMAKER_LOG(pacemaker::LogLevel::OK, "starting");
+
+		Options opts = parse_args(argc, argv);
+
+		auto default_patch = pacemaker::Patch {
+			pacemaker::Channel { { 0, pacemaker::MIDI_NOTE_ON }, 2s, 0s, pacemaker::Notes { 64 } },
+			pacemaker::Channel { { 0, pacemaker::MIDI_NOTE_OFF }, 2s, 1s, pacemaker::Notes { 64 } },
+		};
+
+		if (not opts.patch.empty()) {
+			default_patch = load_patch(opts.patch);
+		}
 
-		// 	std::swap(timeline_reader, timeline_writer);
-		// 	it = timeline_reader.begin();
+		if (not opts.render.empty()) {
+			render(opts, default_patch);
+		}
+		else {
+			live(opts, default_patch);
+		}
 
-		// 	writer_ready = false;
-		// 	reader_ready = false;
-		// }
+		if (not opts.trace.empty()) {
+			write_trace(opts.trace);
+		}
 
 		PACEMAKER_LOG(pacemaker::LogLevel::OK, "done!");
 	}